@@ -1,21 +1,44 @@
 #include "anvil.h"
 
+#include "light.h"
 #include "mc.h"
 #include "nbt.h"
 #include "region.h"
+#include "zpool.h"
 
 #include <assert.h>
 #include <endian.h>
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
-#define COMPRESSION_TYPE_ZLIB 2
 #define GLOBAL_BITS_PER_BLOCK 14
 
+#define SECTOR_LEN 4096
+/* chunks at most this many sectors apart get read together, since reading a
+ * few sectors nobody wants is cheaper than another seek */
+#define READ_GAP_SECTORS 8
+/* but a single read doesn't get any bigger than this */
+#define READ_MAX_SECTORS 256
+
+/* Inflates a chunk's compressed data into *chunk, growing it if it has to */
+static enum anvil_err inflate_chunk(Bytef *in, size_t in_len,
+				    size_t *chunk_buf_len, Bytef **chunk,
+				    size_t *out_len)
+{
+	/* chunks usually inflate to a few times their compressed size */
+	return zpool_inflate(in, in_len, in_len * 4, chunk, chunk_buf_len,
+			     out_len);
+}
+
 enum anvil_err anvil_read_chunk(FILE *f, int x, int z, size_t *chunk_buf_len,
 				Bytef **chunk, size_t *out_len)
 {
+	/* regions that don't have a file yet don't have any chunks either */
+	if (f == NULL)
+		return ANVIL_CHUNK_MISSING;
 	fseek(f, 4 * ((x & 31) + (z & 31) * 32), SEEK_SET);
 	int chunk_offset = 0;
 	for (int i = 2; i >= 0; --i)
@@ -31,7 +54,7 @@ enum anvil_err anvil_read_chunk(FILE *f, int x, int z, size_t *chunk_buf_len,
 	for (int i = 3; i >= 0; --i)
 		compressed_len += fgetc(f) << (8 * i);
 	compressed_len -= 1;
-	assert(fgetc(f) == COMPRESSION_TYPE_ZLIB);
+	assert(fgetc(f) == ANVIL_COMPRESSION_ZLIB);
 	Bytef *compressed_chunk = malloc(sizeof(Bytef) * compressed_len);
 	int n =
 	    fread(compressed_chunk, (size_t) sizeof(Bytef), compressed_len, f);
@@ -40,36 +63,10 @@ enum anvil_err anvil_read_chunk(FILE *f, int x, int z, size_t *chunk_buf_len,
 		return ANVIL_READ_ERROR;
 	}
 
-	z_stream stream = { 0 };
-	stream.next_in = compressed_chunk;
-	stream.avail_in = compressed_len;
-	int z_err = inflateInit(&stream);
-	if (z_err != Z_OK) {
-		fprintf(stderr, "zlib error: %d\n", z_err);
-		return ANVIL_ZLIB_ERROR;
-	}
-	if (sectors * 4096 > *chunk_buf_len) {
-		*chunk_buf_len = sectors * 4096;
-		*chunk = reallocarray(*chunk, *chunk_buf_len, sizeof(Bytef));
-	}
-	stream.next_out = *chunk;
-	stream.avail_out = *chunk_buf_len;
-	while ((z_err = inflate(&stream, Z_NO_FLUSH)) == Z_BUF_ERROR
-	       || (z_err == Z_OK && stream.avail_out == 0)) {
-		*chunk_buf_len += 4096;
-		stream.avail_out = 4096;
-		*chunk = reallocarray(*chunk, *chunk_buf_len, sizeof(Bytef));
-		stream.next_out = *chunk + stream.total_out;
-	}
-	inflateEnd(&stream);
+	enum anvil_err err = inflate_chunk(compressed_chunk, compressed_len,
+					   chunk_buf_len, chunk, out_len);
 	free(compressed_chunk);
-	if (z_err == Z_STREAM_END) {
-		*out_len = (size_t) stream.total_out;
-		return ANVIL_OK;
-	} else {
-		fprintf(stderr, "zlib inflate error: %d\n", z_err);
-		return ANVIL_ZLIB_ERROR;
-	}
+	return err;
 }
 
 /* returns the length of a string w/ a block's name + all of it's properties
@@ -154,35 +151,114 @@ static int palette_entry_to_block_id(struct hashmap *block_table,
 	}
 
 	int *id = hashmap_get(block_table, name);
+	if (id == NULL)
+		fprintf(stderr, "no block id for block '%s'\n", name);
 	free(name);
 	free(properties);
-	if (id == NULL) {
-		fprintf(stderr, "no block id for block '%s'\n", name);
-		return 0;
-	} else {
-		return *id;
+	return id == NULL ? 0 : *id;
+}
+
+static int palette_bits_per_block(int palette_len)
+{
+	int bits_per_block = (int) ceil(log2(palette_len));
+	if (bits_per_block < MIN_BITS_PER_BLOCK)
+		return MIN_BITS_PER_BLOCK;
+	else if (bits_per_block > 8)
+		return GLOBAL_BITS_PER_BLOCK;
+	else
+		return bits_per_block;
+}
+
+/* Fills in everything about a section that can be worked out without copying
+ * anything, adding how much of the chunk's arena it'll need to arena_len. The
+ * section's blockstates and light arrays point into the NBT until
+ * copy_section(). Returns ANVIL_BAD_CHUNK if it has a palette but its
+ * BlockStates are missing or too short for it. */
+static enum anvil_err borrow_section(struct nbt *s_nbt, struct section *s,
+				     int *uniform_idx, size_t *arena_len)
+{
+	struct nbt *palette = nbt_get(s_nbt, TAG_List, "Palette");
+	if (palette != NULL && !list_empty(palette->data.list->head)) {
+		s->palette_len = list_len(palette->data.list->head);
+		s->bits_per_block = palette_bits_per_block(s->palette_len);
+	}
+
+	struct nbt *blockstates = nbt_get(s_nbt, TAG_Long_Array, "BlockStates");
+	if (s->bits_per_block > 0) {
+		/* without them every block would quietly turn into the first
+		 * one in the palette */
+		if (blockstates == NULL
+		    || blockstates->data.array->len
+			   < BLOCKSTATES_LEN(s->bits_per_block))
+			return ANVIL_BAD_CHUNK;
+		s->blockstates =
+		    (uint64_t *) blockstates->data.array->data.longs;
+	}
+	*uniform_idx = section_uniform_index(s);
+
+	struct nbt *sky_light = nbt_get(s_nbt, TAG_Byte_Array, "SkyLight");
+	if (sky_light != NULL
+	    && sky_light->data.array->len == SECTION_LIGHT_LEN) {
+		s->sky_light = (uint8_t *) sky_light->data.array->data.bytes;
 	}
+	struct nbt *block_light = nbt_get(s_nbt, TAG_Byte_Array, "BlockLight");
+	if (block_light != NULL
+	    && block_light->data.array->len == SECTION_LIGHT_LEN) {
+		s->block_light =
+		    (uint8_t *) block_light->data.array->data.bytes;
+	}
+
+	if (*uniform_idx >= 0) {
+		*arena_len += CHUNK_ARENA_ALIGN(sizeof(int));
+	} else if (s->palette_len > 0) {
+		*arena_len += CHUNK_ARENA_ALIGN(sizeof(int) * s->palette_len);
+		*arena_len +=
+		    sizeof(uint64_t) * BLOCKSTATES_LEN(s->bits_per_block);
+	}
+	return ANVIL_OK;
 }
 
-static void build_palette(struct hashmap *block_table, struct section *s,
-			  struct nbt_list *palette)
+/* moves a section borrowed by borrow_section() out of the NBT */
+static void copy_section(struct hashmap *block_table, struct chunk *c,
+			 struct nbt *s_nbt, struct section *s, int uniform_idx)
 {
-	s->palette_len = list_len(palette->head);
-	s->bits_per_block = (int) ceil(log2(s->palette_len));
-	if (s->bits_per_block < 4)
-		s->bits_per_block = 4;
-	else if (s->bits_per_block > 8)
-		s->bits_per_block = GLOBAL_BITS_PER_BLOCK;
-
-	s->palette = malloc(sizeof(int) * s->palette_len);
-	struct list *l = palette->head;
-	int i = 0;
-	while (!list_empty(l)) {
-		s->palette[i] =
-		    palette_entry_to_block_id(block_table, list_item(l));
-		++i;
-		l = list_next(l);
+	if (uniform_idx >= 0) {
+		struct nbt *palette = nbt_get(s_nbt, TAG_List, "Palette");
+		struct list *l = palette->data.list->head;
+		for (int i = 0; i < uniform_idx; ++i)
+			l = list_next(l);
+		s->palette = chunk_alloc(c, sizeof(int));
+		s->palette[0] = palette_entry_to_block_id(block_table,
+							   list_item(l));
+		s->palette_len = 1;
+		s->bits_per_block = MIN_BITS_PER_BLOCK;
+		s->blockstates = NULL;
+	} else if (s->palette_len > 0) {
+		struct nbt *palette = nbt_get(s_nbt, TAG_List, "Palette");
+		struct list *l = palette->data.list->head;
+		s->palette = chunk_alloc(c, sizeof(int) * s->palette_len);
+		for (int i = 0; i < s->palette_len; ++i) {
+			s->palette[i] = palette_entry_to_block_id(
+			    block_table, list_item(l));
+			l = list_next(l);
+		}
+
+		size_t blockstates_len =
+		    sizeof(uint64_t) * BLOCKSTATES_LEN(s->bits_per_block);
+		uint64_t *blockstates = chunk_alloc(c, blockstates_len);
+		if (s->blockstates != NULL)
+			memcpy(blockstates, s->blockstates, blockstates_len);
+		else
+			memset(blockstates, 0, blockstates_len);
+		s->blockstates = blockstates;
 	}
+
+	/* light isn't in the arena, it's shared with every other section
+	 * that has the same light */
+	if (s->sky_light != NULL)
+		s->sky_light = light_intern(s->sky_light);
+	if (s->block_light != NULL)
+		s->block_light = light_intern(s->block_light);
 }
 
 enum anvil_err anvil_parse_chunk(struct hashmap *block_table,
@@ -204,65 +280,74 @@ enum anvil_err anvil_parse_chunk(struct hashmap *block_table,
 	struct nbt *sections = nbt_get(level, TAG_List, "Sections");
 	if (sections == NULL) {
 		fprintf(stderr, "couldn't find sections, aborting\n");
+		nbt_free(n);
 		return ANVIL_BAD_CHUNK;
 	}
 
+	/* work out how big the chunk is before allocating it, so everything
+	 * in it can go in one allocation */
+	struct section s[CHUNK_SECTIONS_LEN] = { 0 };
+	struct nbt *s_nbts[CHUNK_SECTIONS_LEN] = { 0 };
+	int uniform_idxs[CHUNK_SECTIONS_LEN];
+	int sections_len = 0;
+	size_t arena_len = 0;
 	struct list *l = sections->data.list->head;
-	struct chunk *c = malloc(sizeof(struct chunk));
-	c->sections_len = 0;
-	// FIXME: remove this
-	c->player_count = 0;
 	while (!list_empty(l)) {
 		struct nbt *s_nbt = list_item(l);
-		struct section *s = calloc(1, sizeof(struct section));
-
-		struct nbt *y_index = nbt_get(s_nbt, TAG_Byte, "Y");
-		if (y_index != NULL) {
-			s->y = y_index->data.t_byte;
+		int8_t y = 0;
+		nbt_get_value(s_nbt, TAG_Byte, "Y", &y);
+		int i = CHUNK_SECTION_INDEX(y);
+		if (i < 0 || i >= CHUNK_SECTIONS_LEN || s_nbts[i] != NULL) {
+			nbt_free(n);
+			return ANVIL_BAD_CHUNK;
 		}
 
-		struct nbt *palette = nbt_get(s_nbt, TAG_List, "Palette");
-		s->bits_per_block = -1;
-		s->palette_len = -1;
-		if (palette != NULL) {
-			build_palette(block_table, s, palette->data.list);
-		}
-
-		struct nbt *blockstates =
-		    nbt_get(s_nbt, TAG_Long_Array, "BlockStates");
-		if (blockstates != NULL) {
-			s->blockstates =
-			    (uint64_t *) blockstates->data.array->data.longs;
-			blockstates->data.array->data.longs = NULL;
-		}
-
-		struct nbt *sky_light =
-		    nbt_get(s_nbt, TAG_Byte_Array, "SkyLight");
-		if (sky_light != NULL) {
-			s->sky_light =
-			    (uint8_t *) sky_light->data.array->data.bytes;
-			sky_light->data.array->data.bytes = NULL;
+		s_nbts[i] = s_nbt;
+		s[i].y = y;
+		s[i].palette_len = -1;
+		s[i].bits_per_block = -1;
+		if (borrow_section(s_nbt, &s[i], &uniform_idxs[i], &arena_len)
+		    != ANVIL_OK) {
+			nbt_free(n);
+			return ANVIL_BAD_CHUNK;
 		}
+		if (i >= sections_len)
+			sections_len = i + 1;
+		l = list_next(l);
+	}
 
-		struct nbt *block_light =
-		    nbt_get(s_nbt, TAG_Byte_Array, "BlockLight");
-		if (block_light != NULL) {
-			s->block_light =
-			    (uint8_t *) block_light->data.array->data.bytes;
-			block_light->data.array->data.bytes = NULL;
+	struct chunk *c = chunk_new(arena_len);
+	if (c == NULL) {
+		nbt_free(n);
+		return ANVIL_NO_MEMORY;
+	}
+	c->sections_len = sections_len;
+	for (int i = 0; i < sections_len; ++i) {
+		if (s_nbts[i] != NULL) {
+			c->sections[i] = s[i];
+			copy_section(block_table, c, s_nbts[i],
+				     &c->sections[i], uniform_idxs[i]);
 		}
+	}
 
-		c->sections[c->sections_len] = s;
-		++(c->sections_len);
-		l = list_next(l);
+	struct nbt *heightmaps = nbt_get(level, TAG_Compound, "Heightmaps");
+	struct nbt *motion_blocking = NULL;
+	if (heightmaps != NULL) {
+		motion_blocking =
+		    nbt_get(heightmaps, TAG_Long_Array, "MOTION_BLOCKING");
+	}
+	if (motion_blocking != NULL
+	    && motion_blocking->data.array->len == HEIGHTMAP_LEN) {
+		memcpy(c->heightmap, motion_blocking->data.array->data.longs,
+		       sizeof(c->heightmap));
+		c->has_heightmap = true;
 	}
 
-	c->biomes = NULL;
 	struct nbt *biomes = nbt_get(level, TAG_Int_Array, "Biomes");
 	if (biomes != NULL) {
 		assert(biomes->data.array->len == BIOMES_LEN);
-		c->biomes = biomes->data.array->data.ints;
-		biomes->data.array->data.ints = NULL;
+		for (int i = 0; i < BIOMES_LEN; ++i)
+			c->biomes[i] = biomes->data.array->data.ints[i];
 	}
 
 	nbt_free(n);
@@ -285,18 +370,84 @@ enum anvil_err get_chunk(FILE *region_file, struct hashmap *block_table, int x,
 	}
 }
 
-enum anvil_err anvil_get_chunk(const struct region *region,
+enum anvil_err anvil_get_chunk(struct region *region,
 			       struct hashmap *block_table, int x, int z,
 			       struct chunk **out)
 {
+	FILE *f = region_file(region);
+	if (f == NULL && region->has_file)
+		return ANVIL_ERRNO;
 	size_t chunk_buf_len = 0;
 	Bytef *chunk_buf = NULL;
-	enum anvil_err err = get_chunk(region->file, block_table, x, z,
-				       &chunk_buf_len, &chunk_buf, out);
+	enum anvil_err err = get_chunk(f, block_table, x, z, &chunk_buf_len,
+				       &chunk_buf, out);
 	free(chunk_buf);
 	return err;
 }
 
+/* where a chunk is in its region file, going by the region's header */
+struct chunk_location {
+	int x;
+	int z;
+	uint32_t offset; /* in sectors */
+	uint32_t sectors;
+};
+
+static int chunk_location_cmp(const void *p1, const void *p2)
+{
+	const struct chunk_location *l1 = p1;
+	const struct chunk_location *l2 = p2;
+	return (l1->offset > l2->offset) - (l1->offset < l2->offset);
+}
+
+/* pread() that keeps going until it's read len bytes or hit the end of the
+ * file, returns how much it read or -1 */
+static ssize_t pread_all(int fd, void *buf, size_t len, off_t offset)
+{
+	size_t total = 0;
+	while (total < len) {
+		ssize_t n = pread(fd, (uint8_t *) buf + total, len - total,
+				  offset + total);
+		if (n < 0)
+			return -1;
+		else if (n == 0)
+			break;
+		total += n;
+	}
+	return total;
+}
+
+/* Inflates and parses a chunk out of the sectors it was read into. avail is
+ * how much of them was actually there, in case the file ends early. */
+static enum anvil_err parse_sectors(struct hashmap *block_table,
+				    Bytef *sectors, size_t avail,
+				    size_t *chunk_buf_len, Bytef **chunk_buf,
+				    struct chunk **out)
+{
+	if (avail < 5)
+		return ANVIL_READ_ERROR;
+	size_t compressed_len = ((size_t) sectors[0] << 24)
+				| ((size_t) sectors[1] << 16)
+				| ((size_t) sectors[2] << 8) | sectors[3];
+	if (compressed_len == 0 || compressed_len > avail - 4)
+		return ANVIL_READ_ERROR;
+	else if (sectors[4] != ANVIL_COMPRESSION_ZLIB)
+		return ANVIL_BAD_CHUNK;
+
+
+	size_t chunk_data_len;
+	enum anvil_err err =
+	    inflate_chunk(sectors + 5, compressed_len - 1, chunk_buf_len,
+			  chunk_buf, &chunk_data_len);
+	if (err != ANVIL_OK)
+		return err;
+	return anvil_parse_chunk(block_table, chunk_data_len, *chunk_buf,
+				 out);
+}
+
+/* Chunks are read in the order they're laid out in the file, with chunks
+ * that are close together read in one go, so loading a whole area is mostly
+ * sequential reads instead of a seek per chunk. */
 enum anvil_err anvil_get_chunks(struct anvil_get_chunks_ctx *ctx,
 				struct region *region)
 {
@@ -305,40 +456,339 @@ enum anvil_err anvil_get_chunks(struct anvil_get_chunks_ctx *ctx,
 		return ANVIL_BAD_RANGE;
 	}
 
-	size_t chunk_buf_len = 0;
-	Bytef *chunk_buf = NULL;
-	struct chunk *chunk = NULL;
-	enum anvil_err err = ANVIL_OK;
-	int z = ctx->cz1;
-	int x = ctx->cx1;
+	FILE *f = region_file(region);
+	uint8_t header[SECTOR_LEN];
+	if (f == NULL && region->has_file) {
+		ctx->err_x = ctx->cx1;
+		ctx->err_z = ctx->cz1;
+		return ANVIL_ERRNO;
+	} else if (f != NULL
+		   && pread_all(fileno(f), header, SECTOR_LEN, 0)
+			  != SECTOR_LEN) {
+		ctx->err_x = ctx->cx1;
+		ctx->err_z = ctx->cz1;
+		return ANVIL_READ_ERROR;
+	}
+
+	/* everything that still needs loading, missing chunks aside */
+	struct chunk_location locations[1024];
+	int locations_len = 0;
 	// FIXME: ANVIL_CHUNK_MISSING shouldn't be an acceptable error
 	int missing = 0;
-	while (z <= ctx->cz2
-	       && (err == ANVIL_OK || err == ANVIL_CHUNK_MISSING)) {
-		x = ctx->cx1;
-		while (x <= ctx->cx2
-		       && (err == ANVIL_OK || err == ANVIL_CHUNK_MISSING)) {
-			if (region_get_chunk(region, x, z) == NULL) {
-				err = get_chunk(region->file, ctx->block_table,
-						x, z, &chunk_buf_len,
-						&chunk_buf, &chunk);
-				if (err == ANVIL_CHUNK_MISSING) {
-					++missing;
-				} else {
-					region_set_chunk(region, x, z, chunk);
-				}
+	for (int z = ctx->cz1; z <= ctx->cz2; ++z) {
+		for (int x = ctx->cx1; x <= ctx->cx2; ++x) {
+			if (region_get_chunk(region, x, z) != NULL
+			    || region_is_generating(region, x, z))
+				continue;
+			uint8_t *entry = NULL;
+			if (f != NULL)
+				entry = header + 4 * ((x & 31) + (z & 31) * 32);
+			if (entry == NULL
+			    || (entry[0] == 0 && entry[1] == 0 && entry[2] == 0)
+			    || entry[3] == 0) {
+				++missing;
+				continue;
 			}
-			++x;
+			locations[locations_len++] = (struct chunk_location){
+				.x = x,
+				.z = z,
+				.offset = entry[0] << 16 | entry[1] << 8
+					  | entry[2],
+				.sectors = entry[3],
+			};
 		}
-		++z;
 	}
-	free(chunk_buf);
 	ctx->missing = missing;
-	if (err != ANVIL_OK && err != ANVIL_CHUNK_MISSING) {
-		ctx->err_x = x - 1;
-		ctx->err_z = z - 1;
+	qsort(locations, locations_len, sizeof(struct chunk_location),
+	      chunk_location_cmp);
+
+	Bytef *read_buf = NULL;
+	size_t read_buf_len = 0;
+	Bytef *chunk_buf = NULL;
+	size_t chunk_buf_len = 0;
+	enum anvil_err err = ANVIL_OK;
+	int i = 0;
+	/* the chunk that failed to load, or the first of the ones that
+	 * failed to be read */
+	int i_err = 0;
+	while (i < locations_len && err == ANVIL_OK) {
+		i_err = i;
+		/* take in as many of the next chunks as fit in one read */
+		uint32_t start = locations[i].offset;
+		uint32_t end = start + locations[i].sectors;
+		int j = i + 1;
+		while (j < locations_len
+		       && locations[j].offset <= end + READ_GAP_SECTORS
+		       && locations[j].offset + locations[j].sectors - start
+			      <= READ_MAX_SECTORS) {
+			uint32_t chunk_end =
+			    locations[j].offset + locations[j].sectors;
+			if (chunk_end > end)
+				end = chunk_end;
+			++j;
+		}
+
+		size_t len = (size_t) (end - start) * SECTOR_LEN;
+		if (len > read_buf_len) {
+			Bytef *buf = realloc(read_buf, len);
+			if (buf == NULL) {
+				err = ANVIL_NO_MEMORY;
+				break;
+			}
+			read_buf = buf;
+			read_buf_len = len;
+		}
+		ssize_t n = pread_all(fileno(f), read_buf, len,
+				      (off_t) start * SECTOR_LEN);
+		if (n < 0) {
+			perror("pread");
+			err = ANVIL_READ_ERROR;
+			break;
+		}
+
+		for (; i < j && err == ANVIL_OK; ++i) {
+			struct chunk_location *l = &locations[i];
+			size_t at = (size_t) (l->offset - start) * SECTOR_LEN;
+			struct chunk *chunk = NULL;
+			err = parse_sectors(ctx->block_table, read_buf + at,
+					    (size_t) n > at ? n - at : 0,
+					    &chunk_buf_len, &chunk_buf, &chunk);
+			if (err == ANVIL_OK)
+				region_set_chunk(region, l->x, l->z, chunk);
+			else
+				i_err = i;
+		}
+	}
+	free(read_buf);
+	free(chunk_buf);
+	if (err != ANVIL_OK) {
+		ctx->err_x = locations[i_err].x;
+		ctx->err_z = locations[i_err].z;
+	}
+	return err;
+}
+
+/* adds a tag to a compound's children, or to a list's if name is NULL */
+static struct nbt *add_tag(struct list *children, enum tag t, char *name)
+{
+	struct nbt *n = calloc(1, sizeof(struct nbt));
+	n->tag = t;
+	if (name != NULL)
+		n->name = strdup(name);
+	if (t == TAG_Compound)
+		n->data.children = list_new();
+	list_append(children, sizeof(struct nbt *), &n);
+	return n;
+}
+
+static struct nbt *add_list(struct list *children, char *name, enum tag type)
+{
+	struct nbt *n = add_tag(children, TAG_List, name);
+	n->data.list = malloc(sizeof(struct nbt_list));
+	n->data.list->type = type;
+	n->data.list->head = list_new();
+	return n;
+}
+
+/* the array gets its own copy of data, since nbt_free() frees it */
+static void add_array(struct list *children, enum tag t, char *name,
+		      int32_t len, size_t elem_len, const void *data)
+{
+	struct nbt *n = add_tag(children, t, name);
+	n->data.array = malloc(sizeof(struct nbt_array));
+	n->data.array->type = t == TAG_Byte_Array  ? TAG_Byte
+			      : t == TAG_Int_Array ? TAG_Int
+						   : TAG_Long;
+	n->data.array->len = len;
+	n->data.array->data.bytes = malloc(len * elem_len);
+	if (data != NULL)
+		memcpy(n->data.array->data.bytes, data, len * elem_len);
+	else
+		memset(n->data.array->data.bytes, 0, len * elem_len);
+}
+
+static void add_string(struct list *children, char *name, const char *s,
+		       size_t len)
+{
+	struct nbt *n = add_tag(children, TAG_String, name);
+	n->data.string = strndup(s, len);
+}
+
+/* the opposite of palette_entry_to_block_id(), turns something like
+ * "minecraft:water;level=5" back into Name and Properties */
+static void add_palette_entry(struct list *palette, const char *name)
+{
+	struct nbt *entry = add_tag(palette, TAG_Compound, NULL);
+	const char *props = strchr(name, ';');
+	add_string(entry->data.children, "Name", name,
+		   props == NULL ? strlen(name) : (size_t) (props - name));
+	if (props == NULL)
+		return;
+
+	struct nbt *properties =
+	    add_tag(entry->data.children, TAG_Compound, "Properties");
+	while (props != NULL) {
+		const char *key = props + 1;
+		const char *eq = strchr(key, '=');
+		props = strchr(key, ';');
+		if (eq == NULL || (props != NULL && eq > props))
+			break;
+		char *key_str = strndup(key, eq - key);
+		const char *value = eq + 1;
+		add_string(properties->data.children, key_str, value,
+			   props == NULL ? strlen(value)
+					 : (size_t) (props - value));
+		free(key_str);
+	}
+}
+
+static enum anvil_err add_section(struct list *sections,
+				  const struct section *s,
+				  block_name_func block_name)
+{
+	struct nbt *s_nbt = add_tag(sections, TAG_Compound, NULL);
+	struct list *children = s_nbt->data.children;
+	add_tag(children, TAG_Byte, "Y")->data.t_byte = s->y;
+
+	if (s->palette_len > 0) {
+		struct nbt *palette =
+		    add_list(children, "Palette", TAG_Compound);
+		for (int i = 0; i < s->palette_len; ++i) {
+			const char *name = block_name(s->palette[i]);
+			if (name == NULL)
+				return ANVIL_BAD_CHUNK;
+			add_palette_entry(palette->data.list->head, name);
+		}
+		/* uniform sections don't have blockstates, but all zeroes
+		 * points every block at palette[0] */
+		int bits = s->bits_per_block;
+		add_array(children, TAG_Long_Array, "BlockStates",
+			  BLOCKSTATES_LEN(bits), sizeof(uint64_t),
+			  s->blockstates);
+	}
+	if (s->sky_light != NULL)
+		add_array(children, TAG_Byte_Array, "SkyLight",
+			  SECTION_LIGHT_LEN, 1, s->sky_light);
+	if (s->block_light != NULL)
+		add_array(children, TAG_Byte_Array, "BlockLight",
+			  SECTION_LIGHT_LEN, 1, s->block_light);
+	return ANVIL_OK;
+}
+
+static enum anvil_err chunk_nbt(const struct chunk *c, int c_x, int c_z,
+				block_name_func block_name, struct nbt **out)
+{
+	struct nbt *root = nbt_new(TAG_Compound, "");
+	root->data.children = list_new();
+	add_tag(root->data.children, TAG_Int, "DataVersion")->data.t_int =
+	    ANVIL_DATA_VERSION;
+	struct nbt *level = add_tag(root->data.children, TAG_Compound, "Level");
+	struct list *children = level->data.children;
+	add_tag(children, TAG_Int, "xPos")->data.t_int = c_x;
+	add_tag(children, TAG_Int, "zPos")->data.t_int = c_z;
+	add_tag(children, TAG_Long, "LastUpdate")->data.t_long = 0;
+	add_tag(children, TAG_Long, "InhabitedTime")->data.t_long = 0;
+	add_string(children, "Status", "full", 4);
+	/* the light's already there, so nothing has to relight it on load */
+	add_tag(children, TAG_Byte, "isLightOn")->data.t_byte = 1;
+
+	struct nbt *sections = add_list(children, "Sections", TAG_Compound);
+	for (int i = 0; i < c->sections_len; ++i) {
+		const struct section *s = &c->sections[i];
+		if (s->palette_len <= 0 && s->sky_light == NULL
+		    && s->block_light == NULL)
+			continue;
+		enum anvil_err err =
+		    add_section(sections->data.list->head, s, block_name);
+		if (err != ANVIL_OK) {
+			nbt_free(root);
+			return err;
+		}
+	}
+
+	int32_t biomes[BIOMES_LEN];
+	for (int i = 0; i < BIOMES_LEN; ++i)
+		biomes[i] = c->biomes[i];
+	add_array(children, TAG_Int_Array, "Biomes", BIOMES_LEN,
+		  sizeof(int32_t), biomes);
+	if (c->has_heightmap) {
+		struct nbt *heightmaps =
+		    add_tag(children, TAG_Compound, "Heightmaps");
+		add_array(heightmaps->data.children, TAG_Long_Array,
+			  "MOTION_BLOCKING", HEIGHTMAP_LEN, sizeof(int64_t),
+			  c->heightmap);
+	}
+	add_list(children, "Entities", TAG_End);
+	add_list(children, "TileEntities", TAG_End);
+
+	*out = root;
+	return ANVIL_OK;
+}
+
+enum anvil_err anvil_encode_chunk(const struct chunk *c, int c_x, int c_z,
+				  block_name_func block_name, uint8_t **out,
+				  size_t *out_len)
+{
+	struct nbt *root;
+	enum anvil_err err = chunk_nbt(c, c_x, c_z, block_name, &root);
+	if (err != ANVIL_OK)
 		return err;
-	} else {
-		return ANVIL_OK;
+	uint8_t *packed;
+	size_t packed_len = nbt_pack(root, &packed);
+	nbt_free(root);
+
+	err = zpool_deflate(packed, packed_len, out, out_len);
+	free(packed);
+	return err;
+}
+
+static int write_be(FILE *f, uint32_t n, int bytes)
+{
+	for (int i = bytes - 1; i >= 0; --i)
+		if (fputc((n >> (8 * i)) & 0xff, f) == EOF)
+			return -1;
+	return 0;
+}
+
+enum anvil_err anvil_write_region(FILE *f, uint8_t *const chunks[1024],
+				  const size_t lens[1024],
+				  const uint8_t compression[1024])
+{
+	/* the 5 bytes in front of every chunk are its length + compression
+	 * type, and everything's padded out to whole sectors */
+	uint32_t offsets[1024];
+	uint32_t sectors[1024];
+	uint32_t next = 2;
+	for (int i = 0; i < 1024; ++i) {
+		sectors[i] =
+		    chunks[i] == NULL ? 0 : (lens[i] + 5 + 4095) / 4096;
+		/* FIXME: anything this big goes in its own .mcc file, which
+		 *        isn't supported */
+		if (sectors[i] > 255)
+			return ANVIL_BAD_CHUNK;
+		offsets[i] = sectors[i] == 0 ? 0 : next;
+		next += sectors[i];
+	}
+
+	uint32_t now = time(NULL);
+	for (int i = 0; i < 1024; ++i)
+		if (write_be(f, offsets[i], 3) < 0
+		    || write_be(f, sectors[i], 1) < 0)
+			return ANVIL_ERRNO;
+	for (int i = 0; i < 1024; ++i)
+		if (write_be(f, sectors[i] == 0 ? 0 : now, 4) < 0)
+			return ANVIL_ERRNO;
+
+	static const uint8_t padding[4096] = { 0 };
+	for (int i = 0; i < 1024; ++i) {
+		if (sectors[i] == 0)
+			continue;
+		size_t pad = sectors[i] * 4096 - lens[i] - 5;
+		if (write_be(f, lens[i] + 1, 4) < 0
+		    || write_be(f, compression[i], 1) < 0
+		    || fwrite(chunks[i], 1, lens[i], f) != lens[i]
+		    || fwrite(padding, 1, pad, f) != pad)
+			return ANVIL_ERRNO;
 	}
+	return ANVIL_OK;
 }
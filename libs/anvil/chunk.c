@@ -1,11 +1,165 @@
 #include "chunk.h"
 
+#include "light.h"
+
+#include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
+
+struct chunk *chunk_new(size_t arena_len)
+{
+	struct chunk *c = malloc(sizeof(struct chunk) + arena_len);
+	if (c == NULL)
+		return NULL;
+	memset(c, 0, sizeof(struct chunk));
+	for (int i = 0; i < CHUNK_SECTIONS_LEN; ++i) {
+		c->sections[i].y = i - 1;
+		c->sections[i].palette_len = -1;
+		c->sections[i].bits_per_block = -1;
+	}
+	c->arena_len = arena_len;
+	return c;
+}
+
+void *chunk_alloc(struct chunk *c, size_t len)
+{
+	len = CHUNK_ARENA_ALIGN(len);
+	if (c->arena_used + len > c->arena_len)
+		return NULL;
+	void *p = (uint8_t *) c->arena + c->arena_used;
+	c->arena_used += len;
+	return p;
+}
+
+static int height_get(const int64_t *heightmap, int column)
+{
+	const uint64_t *h = (const uint64_t *) heightmap;
+	const uint64_t mask = (1 << HEIGHTMAP_BITS) - 1;
+	int bit = column * HEIGHTMAP_BITS;
+	int l = bit / 64;
+	int offset = bit % 64;
+	uint64_t v = h[l] >> offset;
+	if (offset + HEIGHTMAP_BITS > 64)
+		v |= h[l + 1] << (64 - offset);
+	return v & mask;
+}
+
+static void height_set(int64_t *heightmap, int column, int height)
+{
+	uint64_t *h = (uint64_t *) heightmap;
+	const uint64_t mask = (1 << HEIGHTMAP_BITS) - 1;
+	const uint64_t v = height & mask;
+	int bit = column * HEIGHTMAP_BITS;
+	int l = bit / 64;
+	int offset = bit % 64;
+	h[l] = (h[l] & ~(mask << offset)) | (v << offset);
+	if (offset + HEIGHTMAP_BITS > 64) {
+		h[l + 1] = (h[l + 1] & ~(mask >> (64 - offset)))
+			   | (v >> (64 - offset));
+	}
+}
+
+int chunk_height_at(const struct chunk *c, int x, int z)
+{
+	return height_get(c->heightmap, (x & 15) + (z & 15) * 16);
+}
+
+int chunk_block_at(const struct chunk *c, int x, int y, int z)
+{
+	int i = CHUNK_SECTION_INDEX(y >> 4);
+	if (y < 0 || i >= c->sections_len || c->sections[i].bits_per_block <= 0)
+		return -1;
+	const struct section *s = &c->sections[i];
+	return s->palette[read_blockstate_at(s, x & 15, y & 15, z & 15)];
+}
+
+void chunk_compute_heightmap(struct chunk *c,
+			     block_predicate_func blocks_motion)
+{
+	uint16_t heights[256] = { 0 };
+	int columns_left = 256;
+	uint16_t idxs[TOTAL_BLOCKSTATES];
+	/* scan down from the top, a whole section at a time, until every
+	 * column has hit something */
+	for (int i = c->sections_len - 1; i > 0 && columns_left > 0; --i) {
+		const struct section *s = &c->sections[i];
+		if (s->bits_per_block <= 0)
+			continue;
+
+		int base = s->y * 16;
+		if (section_is_uniform(s)) {
+			if (blocks_motion(s->palette[0])) {
+				for (int col = 0; col < 256; ++col)
+					if (heights[col] == 0)
+						heights[col] = base + 16;
+				columns_left = 0;
+			}
+			continue;
+		}
+
+		bool blocks[s->palette_len];
+		for (int p = 0; p < s->palette_len; ++p)
+			blocks[p] = blocks_motion(s->palette[p]);
+		section_unpack(s, idxs);
+		for (int y = 15; y >= 0 && columns_left > 0; --y) {
+			const uint16_t *layer = idxs + y * 256;
+			for (int col = 0; col < 256; ++col) {
+				if (heights[col] == 0
+				    && layer[col] < s->palette_len
+				    && blocks[layer[col]]) {
+					heights[col] = base + y + 1;
+					--columns_left;
+				}
+			}
+		}
+	}
+
+	memset(c->heightmap, 0, sizeof(c->heightmap));
+	for (int col = 0; col < 256; ++col)
+		height_set(c->heightmap, col, heights[col]);
+	c->has_heightmap = true;
+}
+
+static bool blocks_motion_at(const struct chunk *c, int x, int y, int z,
+			     block_predicate_func blocks_motion)
+{
+	int block = chunk_block_at(c, x, y, z);
+	return block >= 0 && blocks_motion(block);
+}
+
+void chunk_update_heightmap(struct chunk *c, int x, int y, int z,
+			    block_predicate_func blocks_motion)
+{
+	int column = (x & 15) + (z & 15) * 16;
+	int height = height_get(c->heightmap, column);
+	if (blocks_motion_at(c, x, y, z, blocks_motion)) {
+		if (y + 1 > height)
+			height_set(c->heightmap, column, y + 1);
+	} else if (y + 1 == height) {
+		while (y > 0
+		       && !blocks_motion_at(c, x, y - 1, z, blocks_motion))
+			--y;
+		height_set(c->heightmap, column, y);
+	}
+}
+
+static bool chunk_owns(const struct chunk *c, const void *p)
+{
+	const uint8_t *arena = (const uint8_t *) c->arena;
+	return (const uint8_t *) p >= arena
+	       && (const uint8_t *) p < arena + c->arena_len;
+}
 
 void free_chunk(struct chunk *c)
 {
-	for (int i = 0; i < c->sections_len; ++i)
-		free_section(c->sections[i]);
-	free(c->biomes);
+	/* blockstates allocated after the chunk was loaded, like a uniform
+	 * section that got written to, aren't in the arena */
+	for (int i = 0; i < CHUNK_SECTIONS_LEN; ++i) {
+		struct section *s = &c->sections[i];
+		if (s->blockstates != NULL && !chunk_owns(c, s->blockstates))
+			free(s->blockstates);
+		light_release(s->sky_light);
+		light_release(s->block_light);
+	}
 	free(c);
 }
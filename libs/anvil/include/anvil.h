@@ -11,6 +11,8 @@
 #include <zlib.h>
 
 #define ANVIL_DATA_VERSION 2230
+/* the compression type byte in front of a chunk in a region file */
+#define ANVIL_COMPRESSION_ZLIB 2
 
 struct anvil_get_chunks_ctx {
 	struct hashmap *block_table;
@@ -30,12 +32,32 @@ enum anvil_err anvil_parse_chunk(struct hashmap *block_table,
 /* anvil_get_chunk() and anvil_get_chunks() take chunk coordinates within the
  * region they're in. They're equivalent to calling anvil_read_chunk() and
  * anvil_parse_chunk(), except they handle the buffer junk for you. */
-enum anvil_err anvil_get_chunk(const struct region *,
+enum anvil_err anvil_get_chunk(struct region *,
 			       struct hashmap *block_table, int x, int z,
 			       struct chunk **out);
 /* Get all chunks in the range (cx1,cz1) -> (cx2,cz2), inclusive, assuming
  * those two chunks are in the same region. Only gets chunks that haven't
- * been loaded in yet. */
+ * been loaded in yet, and aren't being generated. Chunks are read in file
+ * order, so this is a lot cheaper than getting them one at a time. Missing
+ * chunks aren't an error, they're counted in ctx->missing. */
 enum anvil_err anvil_get_chunks(struct anvil_get_chunks_ctx *, struct region *);
 
+/* returns a block's name and properties the way they're written in the block
+ * table, like "minecraft:water;level=5", or NULL if it's not a real block */
+typedef const char *(*block_name_func)(int block_id);
+
+/* Encodes a chunk the way it's stored in a region file, zlib-compressed NBT.
+ * Takes global chunk coordinates, since they're written into the chunk. *out
+ * is malloc'd and has to be freed. */
+enum anvil_err anvil_encode_chunk(const struct chunk *, int c_x, int c_z,
+				  block_name_func, uint8_t **out,
+				  size_t *out_len);
+/* Writes a whole region file from compressed chunks, like the ones from
+ * anvil_encode_chunk(), each written with its compression type byte.
+ * Chunks are indexed by x + z * 32 within the region, and NULL ones are left
+ * out. Returns ANVIL_ERRNO if writing failed. */
+enum anvil_err anvil_write_region(FILE *, uint8_t *const chunks[1024],
+				  const size_t lens[1024],
+				  const uint8_t compression[1024]);
+
 #endif // CHOWDER_ANVIL_H
@@ -3,21 +3,63 @@
 
 #include "section.h"
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
 #define BIOMES_LEN	   1024
 #define CHUNK_SECTIONS_LEN 18
+/* sections are indexed by their Y + 1, since the bottom one is at Y = -1 */
+#define CHUNK_SECTION_INDEX(y) ((y) + 1)
+/* heightmaps hold 256 9-bit heights, packed like blockstates */
+#define HEIGHTMAP_BITS 9
+#define HEIGHTMAP_LEN  36
+/* everything in a chunk's arena is 8-byte aligned for the blockstates */
+#define CHUNK_ARENA_ALIGN(len) (((len) + 7) & ~(size_t) 7)
 
+/* A chunk is a single allocation: the sections and biomes live in the struct
+ * itself, and the palettes and blockstates they point to are carved out of
+ * the arena at the end of it. Light arrays are shared, see light.h. */
 struct chunk {
 	int sections_len;
-	struct section *sections[CHUNK_SECTIONS_LEN];
-	int *biomes;
+	struct section sections[CHUNK_SECTIONS_LEN];
+	uint8_t biomes[BIOMES_LEN];
+	/* MOTION_BLOCKING, in the form it's sent to clients. each height is
+	 * one above the highest block in that column, or 0 if it's empty */
+	int64_t heightmap[HEIGHTMAP_LEN];
+	bool has_heightmap;
 
 	/* FIXME: this doesn't belong in anvil. this chunk struct should be
 	 *        'anvil_chunk', and a seperate chunk struct in the main src/
 	 *        should have this reference counter. */
 	// # of players that can see this chunk
 	int player_count;
+
+	size_t arena_len;
+	size_t arena_used;
+	uint64_t arena[];
 };
 
+/* returns a chunk with empty sections and room for arena_len bytes of
+ * section data, or NULL if it couldn't be allocated */
+struct chunk *chunk_new(size_t arena_len);
+/* returns NULL if there isn't enough room left in the arena */
+void *chunk_alloc(struct chunk *, size_t len);
+
+typedef bool (*block_predicate_func)(int block_id);
+
+/* x and z are block coordinates, they don't have to be local to the chunk */
+int chunk_height_at(const struct chunk *, int x, int z);
+/* returns the block id at the given position, or -1 if there's no section
+ * there */
+int chunk_block_at(const struct chunk *, int x, int y, int z);
+/* builds the heightmap from scratch, counting blocks that blocks_motion()
+ * returns true for */
+void chunk_compute_heightmap(struct chunk *, block_predicate_func);
+/* fixes up the heightmap after the block at x,y,z changed */
+void chunk_update_heightmap(struct chunk *, int x, int y, int z,
+			    block_predicate_func);
+
 void free_chunk(struct chunk *);
 
 #endif // CHOWDER_CHUNK_H
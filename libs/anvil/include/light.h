@@ -0,0 +1,36 @@
+/* Light arrays are content-addressed and reference counted, since most
+ * sections have the same light (all 15 sky light, no block light). Every
+ * section with the same light points at the same buffer, so anything that
+ * changes a section's light has to go through light_make_writable() first.
+ * They're safe to call from any thread. */
+#ifndef CHOWDER_LIGHT_H
+#define CHOWDER_LIGHT_H
+
+#include "section.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* returns a shared buffer holding a copy of the given light */
+uint8_t *light_intern(const uint8_t light[SECTION_LIGHT_LEN]);
+/* returns a buffer with the same light that only the caller is using,
+ * copying it if it's shared. the old pointer shouldn't be used after this */
+uint8_t *light_make_writable(uint8_t *light);
+/* returns a new buffer that only the caller is using, with every value in it
+ * set to level */
+uint8_t *light_alloc(int level);
+/* puts a buffer from light_make_writable() or light_alloc() back into the
+ * table once the caller's done writing to it. returns the buffer that should
+ * be used from now on, which is an identical one if there already is one */
+uint8_t *light_share(uint8_t *light);
+/* gives a buffer back, freeing it once nothing's using it. takes NULL too */
+void light_release(uint8_t *light);
+
+/* light is 4 bits per block, in the same order as blockstates */
+int light_get(const uint8_t *light, int x, int y, int z);
+void light_set(uint8_t *light, int x, int y, int z, int level);
+
+/* # of distinct light arrays in use */
+size_t light_shared_len();
+
+#endif // CHOWDER_LIGHT_H
@@ -5,23 +5,65 @@
 #include "chunk.h"
 #include "hashmap.h"
 
+#include <stdbool.h>
 #include <stdio.h>
 
+struct region_files;
+
 struct region {
+	/* NULL if there's no region file, or if it's been closed by the
+	 * region_files it's in. use region_file() instead */
 	FILE *file;
+	/* false if there's no region file yet, in which case every chunk in
+	 * it is missing */
+	bool has_file;
+	char *path;
 	int x;
 	int z;
 	struct chunk *chunks[32][32];
+	/* chunks that are missing and being generated, indexed like chunks */
+	bool generating[32][32];
+	/* how many of chunks aren't NULL, and how many of generating are
+	 * true */
+	int chunks_len;
+	int generating_len;
+
+	/* NULL if it isn't in one. prev and next are only used while the
+	 * file's open */
+	struct region_files *files;
+	struct region *lru_prev;
+	struct region *lru_next;
 };
 
+/* opens a region file, or makes an empty region if the file doesn't exist */
 enum anvil_err region_open(const char *level_path, int x, int z,
 			   struct region **out);
+/* Returns the region's file, reopening it if it was closed, or NULL if it
+ * doesn't have one or it couldn't be reopened. Anything reading the file
+ * should get it from here. */
+FILE *region_file(struct region *);
+
+/* Keeps at most max region files open, closing the least recently used
+ * ones, which get reopened by region_file() when they're needed again. Only
+ * one thread should be using the regions in it. */
+struct region_files *region_files_new(int max);
+/* frees the region_files, every region in it has to have been freed */
+void region_files_free(struct region_files *);
+/* adds a region that's just been opened, which might close the file of the
+ * least recently used one */
+void region_files_add(struct region_files *, struct region *);
 
 /* set/get assume that chunk_x and chunk_z are actually contained in the given
  * region */
 void region_set_chunk(struct region *, int chunk_x, int chunk_z,
 		      struct chunk *);
 struct chunk *region_get_chunk(struct region *, int chunk_x, int chunk_z);
+void region_set_generating(struct region *, int chunk_x, int chunk_z,
+			   bool generating);
+bool region_is_generating(struct region *, int chunk_x, int chunk_z);
+/* true if nothing in the region is loaded or being generated, so it can be
+ * freed */
+bool region_is_empty(const struct region *);
 
 void free_region(struct region *);
 
@@ -1,6 +1,7 @@
 #ifndef CHOWDER_SECTION_H
 #define CHOWDER_SECTION_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #define TOTAL_BLOCKSTATES 4096
@@ -8,6 +9,7 @@
 	(TOTAL_BLOCKSTATES * bits_per_block / 64)
 // NOTE: this is probably a dumb assumption to make, but it works for 1.15.2
 #define SECTION_LIGHT_LEN 2048
+#define MIN_BITS_PER_BLOCK 4
 
 struct section {
 	int8_t y;
@@ -23,9 +25,25 @@ struct section {
 	uint8_t *block_light;
 };
 
+/* A section that's entirely one block (all air, all stone, etc.) doesn't keep
+ * a blockstates array around. Its palette has one entry, every block in it is
+ * palette index 0, and the blockstates get allocated on the first write. */
+bool section_is_uniform(const struct section *);
+/* returns the palette index every block in the section shares, or -1 if
+ * there's more than one */
+int section_uniform_index(const struct section *);
+
 int read_blockstate_at(const struct section *s, int x, int y, int z);
 void write_blockstate_at(struct section *s, int x, int y, int z, int value);
 
-void free_section(struct section *);
+/* section_unpack() decodes every palette index in a section at once, in the
+ * same x + z * 16 + y * 256 order used by the blockstates array. It's a lot
+ * faster than calling read_blockstate_at() 4096 times, so anything that walks
+ * a whole section should use it.
+ *
+ * section_pack() does the opposite, overwriting the section's blockstates with
+ * the given palette indices. Both assume the section has blockstates. */
+void section_unpack(const struct section *s, uint16_t out[TOTAL_BLOCKSTATES]);
+void section_pack(struct section *s, const uint16_t in[TOTAL_BLOCKSTATES]);
 
 #endif // CHOWDER_SECTION_H
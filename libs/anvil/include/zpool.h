@@ -0,0 +1,42 @@
+/* Setting up a zlib stream is expensive, mostly because of the window it
+ * allocates, so streams are kept around and reset between chunks instead of
+ * being set up for every one. Idle streams are shared by every thread, and
+ * everything here is safe to call from any of them.
+ *
+ * If libdeflate is there at build time (HAVE_LIBDEFLATE), zpool_inflate()
+ * uses it instead of zlib, since it's a lot faster at inflating a whole
+ * buffer in one go. */
+#ifndef CHOWDER_ZPOOL_H
+#define CHOWDER_ZPOOL_H
+
+#include "anvil_err.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <zlib.h>
+
+/* returns a reset stream ready for inflate(), or NULL if one couldn't be
+ * made. give it back with zpool_give_inflate() */
+z_stream *zpool_take_inflate();
+void zpool_give_inflate(z_stream *);
+/* same as the inflate ones, except the stream compresses at zlib's default
+ * level */
+z_stream *zpool_take_deflate();
+void zpool_give_deflate(z_stream *);
+
+/* Inflates all of in into *out, which is realloc'd if it's smaller than
+ * *out_cap. It starts at size_hint if that's bigger, and doubles from there,
+ * so a good guess saves going through the data more than once. */
+enum anvil_err zpool_inflate(const uint8_t *in, size_t in_len,
+			     size_t size_hint, uint8_t **out, size_t *out_cap,
+			     size_t *out_len);
+/* compresses in into a new buffer, *out has to be freed */
+enum anvil_err zpool_deflate(const uint8_t *in, size_t in_len, uint8_t **out,
+			     size_t *out_len);
+
+/* frees every idle stream, for when nothing's going to be compressed or
+ * inflated anymore */
+void zpool_free();
+
+#endif // CHOWDER_ZPOOL_H
@@ -0,0 +1,215 @@
+#include "light.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_BUCKETS_LEN 256
+
+struct light_buf {
+	struct light_buf *next;
+	uint64_t hash;
+	int refs;
+	bool shared; /* true while it's in the table */
+	uint8_t data[SECTION_LIGHT_LEN];
+};
+
+static struct {
+	struct light_buf **buckets;
+	size_t buckets_len;
+	size_t len;
+} table;
+
+static struct light_buf *light_buf(uint8_t *light)
+{
+	return (struct light_buf *) (light - offsetof(struct light_buf, data));
+}
+
+/* FNV-1a, a long at a time */
+static uint64_t light_hash(const uint8_t *light)
+{
+	uint64_t hash = 0xcbf29ce484222325;
+	for (size_t i = 0; i < SECTION_LIGHT_LEN; i += sizeof(uint64_t)) {
+		uint64_t l;
+		memcpy(&l, light + i, sizeof(uint64_t));
+		hash ^= l;
+		hash *= 0x100000001b3;
+	}
+	return hash ^ (hash >> 32);
+}
+
+static struct light_buf **bucket(uint64_t hash)
+{
+	return &table.buckets[hash & (table.buckets_len - 1)];
+}
+
+static void table_grow()
+{
+	struct light_buf **old = table.buckets;
+	size_t old_len = table.buckets_len;
+	table.buckets_len =
+	    old_len == 0 ? INITIAL_BUCKETS_LEN : table.buckets_len * 2;
+	table.buckets = calloc(table.buckets_len, sizeof(struct light_buf *));
+	for (size_t i = 0; i < old_len; ++i) {
+		struct light_buf *b = old[i];
+		while (b != NULL) {
+			struct light_buf *next = b->next;
+			struct light_buf **head = bucket(b->hash);
+			b->next = *head;
+			*head = b;
+			b = next;
+		}
+	}
+	free(old);
+}
+
+static void table_remove(struct light_buf *b)
+{
+	struct light_buf **p = bucket(b->hash);
+	while (*p != b)
+		p = &(*p)->next;
+	*p = b->next;
+	b->shared = false;
+	--table.len;
+}
+
+static struct light_buf **table_find(uint64_t hash, const uint8_t *light)
+{
+	struct light_buf **p = bucket(hash);
+	while (*p != NULL
+	       && ((*p)->hash != hash
+		   || memcmp((*p)->data, light, SECTION_LIGHT_LEN)))
+		p = &(*p)->next;
+	return p;
+}
+
+static void table_insert(struct light_buf *b, uint64_t hash)
+{
+	struct light_buf **head = bucket(hash);
+	b->hash = hash;
+	b->shared = true;
+	b->next = *head;
+	*head = b;
+	++table.len;
+}
+
+/* every buffer's refs, and the table, are only touched with this held, since
+ * chunks get generated on other threads */
+static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void release(struct light_buf *b)
+{
+	if (--b->refs == 0) {
+		if (b->shared)
+			table_remove(b);
+		free(b);
+	}
+}
+
+uint8_t *light_intern(const uint8_t light[SECTION_LIGHT_LEN])
+{
+	uint64_t hash = light_hash(light);
+	pthread_mutex_lock(&table_lock);
+	if (table.len >= table.buckets_len)
+		table_grow();
+	struct light_buf *b = *table_find(hash, light);
+	if (b != NULL) {
+		++b->refs;
+	} else if ((b = malloc(sizeof(struct light_buf))) != NULL) {
+		memcpy(b->data, light, SECTION_LIGHT_LEN);
+		b->refs = 1;
+		table_insert(b, hash);
+	}
+	pthread_mutex_unlock(&table_lock);
+	return b == NULL ? NULL : b->data;
+}
+
+uint8_t *light_alloc(int level)
+{
+	struct light_buf *b = malloc(sizeof(struct light_buf));
+	if (b == NULL)
+		return NULL;
+	memset(b->data, level | level << 4, SECTION_LIGHT_LEN);
+	b->next = NULL;
+	b->hash = 0;
+	b->refs = 1;
+	b->shared = false;
+	return b->data;
+}
+
+uint8_t *light_share(uint8_t *light)
+{
+	struct light_buf *b = light_buf(light);
+	/* only the caller has it if it isn't shared, so no need to lock */
+	if (b->shared)
+		return light;
+
+	uint64_t hash = light_hash(light);
+	pthread_mutex_lock(&table_lock);
+	if (table.len >= table.buckets_len)
+		table_grow();
+	struct light_buf *found = *table_find(hash, light);
+	if (found != NULL) {
+		++found->refs;
+		release(b);
+		light = found->data;
+	} else {
+		table_insert(b, hash);
+	}
+	pthread_mutex_unlock(&table_lock);
+	return light;
+}
+
+uint8_t *light_make_writable(uint8_t *light)
+{
+	struct light_buf *b = light_buf(light);
+	pthread_mutex_lock(&table_lock);
+	if (b->refs == 1) {
+		if (b->shared)
+			table_remove(b);
+		pthread_mutex_unlock(&table_lock);
+		return light;
+	}
+	pthread_mutex_unlock(&table_lock);
+
+	uint8_t *copy = light_alloc(0);
+	if (copy == NULL)
+		return NULL;
+	memcpy(copy, light, SECTION_LIGHT_LEN);
+	pthread_mutex_lock(&table_lock);
+	release(b);
+	pthread_mutex_unlock(&table_lock);
+	return copy;
+}
+
+void light_release(uint8_t *light)
+{
+	if (light == NULL)
+		return;
+
+	pthread_mutex_lock(&table_lock);
+	release(light_buf(light));
+	pthread_mutex_unlock(&table_lock);
+}
+
+int light_get(const uint8_t *light, int x, int y, int z)
+{
+	int i = x + z * 16 + y * 256;
+	return (light[i / 2] >> (i % 2 * 4)) & 0xf;
+}
+
+void light_set(uint8_t *light, int x, int y, int z, int level)
+{
+	int i = x + z * 16 + y * 256;
+	int shift = i % 2 * 4;
+	light[i / 2] = (light[i / 2] & ~(0xf << shift)) | (level << shift);
+}
+
+size_t light_shared_len()
+{
+	pthread_mutex_lock(&table_lock);
+	size_t len = table.len;
+	pthread_mutex_unlock(&table_lock);
+	return len;
+}
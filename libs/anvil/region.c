@@ -3,10 +3,19 @@
 #include "strutil.h"
 
 #include <assert.h>
+#include <errno.h>
 #include <stdlib.h>
 
 #define CHUNK_COORD_TO_ARRAY_IDX(n) (n < 0 ? (n + 1) * -1 : n)
 
+struct region_files {
+	/* most recently used first */
+	struct region *head;
+	struct region *tail;
+	int open;
+	int max;
+};
+
 enum anvil_err region_open(const char *level_path, int x, int z,
 			   struct region **out)
 {
@@ -14,33 +23,119 @@ enum anvil_err region_open(const char *level_path, int x, int z,
 	if (region == NULL) {
 		return ANVIL_NO_MEMORY;
 	}
-	char *region_file_path = NULL;
-	if (asprintf(&region_file_path, "%s/region/r.%d.%d.mca", level_path, x,
-		     z)
+	if (asprintf(&region->path, "%s/region/r.%d.%d.mca", level_path, x, z)
 	    < 0) {
 		free(region);
 		return ANVIL_NO_MEMORY;
 	}
 	/* FIXME: the mode here will be an issue when regions eventually
 	 *        become mutable */
-	region->file = fopen(region_file_path, "r");
-	free(region_file_path);
-	if (region->file == NULL) {
+	region->file = fopen(region->path, "r");
+	if (region->file == NULL && errno != ENOENT) {
+		free(region->path);
 		free(region);
 		return ANVIL_ERRNO;
 	}
+	region->has_file = region->file != NULL;
 	region->x = x;
 	region->z = z;
 	*out = region;
 	return ANVIL_OK;
 }
 
+static void lru_remove(struct region_files *files, struct region *r)
+{
+	if (r->lru_prev != NULL)
+		r->lru_prev->lru_next = r->lru_next;
+	else
+		files->head = r->lru_next;
+	if (r->lru_next != NULL)
+		r->lru_next->lru_prev = r->lru_prev;
+	else
+		files->tail = r->lru_prev;
+	r->lru_prev = r->lru_next = NULL;
+}
+
+static void lru_push(struct region_files *files, struct region *r)
+{
+	r->lru_prev = NULL;
+	r->lru_next = files->head;
+	if (files->head != NULL)
+		files->head->lru_prev = r;
+	else
+		files->tail = r;
+	files->head = r;
+}
+
+/* closes files until there are few enough open, starting with the least
+ * recently used */
+static void close_files(struct region_files *files)
+{
+	while (files->open > files->max && files->tail != NULL) {
+		struct region *r = files->tail;
+		lru_remove(files, r);
+		fclose(r->file);
+		r->file = NULL;
+		--files->open;
+	}
+}
+
+FILE *region_file(struct region *r)
+{
+	if (!r->has_file)
+		return NULL;
+	if (r->file == NULL) {
+		r->file = fopen(r->path, "r");
+		if (r->file == NULL) {
+			perror(r->path);
+			return NULL;
+		}
+		if (r->files != NULL) {
+			lru_push(r->files, r);
+			++r->files->open;
+			/* the least recently used one can't be this one, since
+			 * it's at the front */
+			close_files(r->files);
+		}
+	} else if (r->files != NULL && r->files->head != r) {
+		lru_remove(r->files, r);
+		lru_push(r->files, r);
+	}
+	return r->file;
+}
+
+struct region_files *region_files_new(int max)
+{
+	struct region_files *files = calloc(1, sizeof(struct region_files));
+	if (files == NULL)
+		return NULL;
+	files->max = max;
+	return files;
+}
+
+void region_files_free(struct region_files *files)
+{
+	assert(files->head == NULL);
+	free(files);
+}
+
+void region_files_add(struct region_files *files, struct region *r)
+{
+	r->files = files;
+	if (r->file != NULL) {
+		lru_push(files, r);
+		++files->open;
+		close_files(files);
+	}
+}
+
 void region_set_chunk(struct region *r, int c_x, int c_z, struct chunk *chunk)
 {
 	c_x = CHUNK_COORD_TO_ARRAY_IDX(c_x);
 	c_z = CHUNK_COORD_TO_ARRAY_IDX(c_z);
 
 	assert(c_x < 32 && c_z < 32);
+	r->chunks_len += (chunk != NULL) - (r->chunks[c_z][c_x] != NULL);
 	r->chunks[c_z][c_x] = chunk;
 }
 
@@ -53,9 +148,41 @@ struct chunk *region_get_chunk(struct region *r, int c_x, int c_z)
 	return r->chunks[c_z][c_x];
 }
 
+void region_set_generating(struct region *r, int c_x, int c_z,
+			   bool generating)
+{
+	c_x = CHUNK_COORD_TO_ARRAY_IDX(c_x);
+	c_z = CHUNK_COORD_TO_ARRAY_IDX(c_z);
+
+	assert(c_x < 32 && c_z < 32);
+	r->generating_len += generating - r->generating[c_z][c_x];
+	r->generating[c_z][c_x] = generating;
+}
+
+bool region_is_generating(struct region *r, int c_x, int c_z)
+{
+	c_x = CHUNK_COORD_TO_ARRAY_IDX(c_x);
+	c_z = CHUNK_COORD_TO_ARRAY_IDX(c_z);
+
+	assert(c_x < 32 && c_z < 32);
+	return r->generating[c_z][c_x];
+}
+
+bool region_is_empty(const struct region *r)
+{
+	return r->chunks_len == 0 && r->generating_len == 0;
+}
+
 void free_region(struct region *r)
 {
-	fclose(r->file);
+	if (r->file != NULL) {
+		if (r->files != NULL) {
+			lru_remove(r->files, r);
+			--r->files->open;
+		}
+		fclose(r->file);
+	}
+	free(r->path);
 	for (int z = 0; z < 32; ++z)
 		for (int x = 0; x < 32; ++x)
 			if (r->chunks[z][x] != NULL)
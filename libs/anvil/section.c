@@ -1,15 +1,13 @@
 #include "section.h"
 
+#include <assert.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
-uint8_t bitmask(int size)
+uint64_t bitmask(int size)
 {
-	/* probably not necessary xd */
-	if (size > 8)
-		return 0xff;
-
-	return (1 << size) - 1;
+	return (UINT64_C(1) << size) - 1;
 }
 
 struct block_pos {
@@ -44,6 +42,9 @@ struct block_pos block_pos(const struct section *s, int x, int y, int z)
  */
 int read_blockstate_at(const struct section *s, int x, int y, int z)
 {
+	if (section_is_uniform(s))
+		return 0;
+
 	struct block_pos p = block_pos(s, x, y, z);
 	int palette_index = s->blockstates[p.start_long] >> p.offset;
 	if (p.start_long != p.end_long) {
@@ -55,20 +56,147 @@ int read_blockstate_at(const struct section *s, int x, int y, int z)
 
 void write_blockstate_at(struct section *s, int x, int y, int z, int value)
 {
+	if (section_is_uniform(s)) {
+		/* all zeroes, which is palette[0] everywhere */
+		s->blockstates = calloc(BLOCKSTATES_LEN(s->bits_per_block),
+					sizeof(uint64_t));
+	}
+
 	struct block_pos p = block_pos(s, x, y, z);
 	uint64_t v = value & p.mask;
+	s->blockstates[p.start_long] &= ~(p.mask << p.offset);
 	s->blockstates[p.start_long] |= (v << p.offset);
 	if (p.start_long != p.end_long) {
 		int end_offset = 64 - p.offset;
+		s->blockstates[p.end_long] &= ~(p.mask >> end_offset);
 		s->blockstates[p.end_long] |= v >> end_offset;
 	}
 }
 
-void free_section(struct section *s)
+/* 64 blocks always take up exactly BITS longs, so the kernels below work on
+ * groups of 64 blocks at a time. BITS is a constant in each kernel, so the
+ * offsets and masks in the inner loop get folded at compile time. */
+#define GROUP_LEN 64
+
+#define UNPACK_KERNEL(BITS)                                                    \
+	static void unpack_##BITS(const uint64_t *in, uint16_t *out)           \
+	{                                                                      \
+		const uint64_t mask = (1 << BITS) - 1;                         \
+		for (int g = 0; g < TOTAL_BLOCKSTATES / GROUP_LEN; ++g) {      \
+			for (int i = 0; i < GROUP_LEN; ++i) {                  \
+				const int bit = i * BITS;                      \
+				const int l = bit / 64;                        \
+				const int offset = bit % 64;                   \
+				uint64_t v = in[l] >> offset;                  \
+				if (offset + BITS > 64)                        \
+					v |= in[l + 1] << (64 - offset);       \
+				out[i] = v & mask;                             \
+			}                                                      \
+			in += BITS;                                            \
+			out += GROUP_LEN;                                      \
+		}                                                              \
+	}
+
+#define PACK_KERNEL(BITS)                                                      \
+	static void pack_##BITS(uint64_t *out, const uint16_t *in)             \
+	{                                                                      \
+		const uint64_t mask = (1 << BITS) - 1;                         \
+		memset(out, 0, sizeof(uint64_t) * BLOCKSTATES_LEN(BITS));      \
+		for (int g = 0; g < TOTAL_BLOCKSTATES / GROUP_LEN; ++g) {      \
+			for (int i = 0; i < GROUP_LEN; ++i) {                  \
+				const int bit = i * BITS;                      \
+				const int l = bit / 64;                        \
+				const int offset = bit % 64;                   \
+				const uint64_t v = in[i] & mask;               \
+				out[l] |= v << offset;                         \
+				if (offset + BITS > 64)                        \
+					out[l + 1] |= v >> (64 - offset);      \
+			}                                                      \
+			in += GROUP_LEN;                                       \
+			out += BITS;                                           \
+		}                                                              \
+	}
+
+#define KERNELS(BITS) UNPACK_KERNEL(BITS) PACK_KERNEL(BITS)
+
+KERNELS(4)
+KERNELS(5)
+KERNELS(6)
+KERNELS(7)
+KERNELS(8)
+KERNELS(14)
+
+typedef void (*unpack_func)(const uint64_t *, uint16_t *);
+typedef void (*pack_func)(uint64_t *, const uint16_t *);
+
+#define KERNEL_SLOT(BITS) [BITS] = { unpack_##BITS, pack_##BITS }
+
+static const struct {
+	unpack_func unpack;
+	pack_func pack;
+} kernels[] = {
+	KERNEL_SLOT(4), KERNEL_SLOT(5), KERNEL_SLOT(6),
+	KERNEL_SLOT(7), KERNEL_SLOT(8), KERNEL_SLOT(14),
+};
+
+#define KERNELS_LEN (int) (sizeof(kernels) / sizeof(kernels[0]))
+
+/* for the odd bit widths that don't get their own kernel */
+static void unpack_slow(const struct section *s, uint16_t *out)
+{
+	for (int i = 0; i < TOTAL_BLOCKSTATES; ++i)
+		out[i] = read_blockstate_at(s, i % 16, i / 256, (i / 16) % 16);
+}
+
+static void pack_slow(struct section *s, const uint16_t *in)
+{
+	memset(s->blockstates, 0,
+	       sizeof(uint64_t) * BLOCKSTATES_LEN(s->bits_per_block));
+	for (int i = 0; i < TOTAL_BLOCKSTATES; ++i)
+		write_blockstate_at(s, i % 16, i / 256, (i / 16) % 16, in[i]);
+}
+
+void section_unpack(const struct section *s, uint16_t out[TOTAL_BLOCKSTATES])
+{
+	assert(s->bits_per_block > 0);
+	if (section_is_uniform(s))
+		memset(out, 0, sizeof(uint16_t) * TOTAL_BLOCKSTATES);
+	else if (s->bits_per_block < KERNELS_LEN
+		 && kernels[s->bits_per_block].unpack != NULL)
+		kernels[s->bits_per_block].unpack(s->blockstates, out);
+	else
+		unpack_slow(s, out);
+}
+
+void section_pack(struct section *s, const uint16_t in[TOTAL_BLOCKSTATES])
+{
+	assert(s->bits_per_block > 0);
+	if (section_is_uniform(s))
+		s->blockstates = malloc(sizeof(uint64_t)
+					* BLOCKSTATES_LEN(s->bits_per_block));
+	if (s->bits_per_block < KERNELS_LEN
+	    && kernels[s->bits_per_block].pack != NULL)
+		kernels[s->bits_per_block].pack(s->blockstates, in);
+	else
+		pack_slow(s, in);
+}
+
+bool section_is_uniform(const struct section *s)
 {
-	free(s->palette);
-	free(s->blockstates);
-	free(s->sky_light);
-	free(s->block_light);
-	free(s);
+	return s->bits_per_block > 0 && s->blockstates == NULL;
+}
+
+int section_uniform_index(const struct section *s)
+{
+	if (s->bits_per_block <= 0)
+		return -1;
+	else if (s->palette_len == 1 || section_is_uniform(s))
+		return 0;
+
+	uint16_t idxs[TOTAL_BLOCKSTATES];
+	section_unpack(s, idxs);
+	for (int i = 1; i < TOTAL_BLOCKSTATES; ++i)
+		if (idxs[i] != idxs[0])
+			return -1;
+	return idxs[0];
 }
@@ -1,6 +1,16 @@
+#include "anvil.h"
+#include "chunk.h"
+#include "light.h"
 #include "region.h"
+#include "section.h"
+#include "zpool.h"
 
 #include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 void test_region()
 {
@@ -18,9 +28,332 @@ void test_region()
 	assert(region.chunks[1][1]->sections_len == chunk.sections_len);
 	assert(region_get_chunk(&region, -2, -2)->sections_len
 	       == chunk.sections_len);
+
+	assert(region.chunks_len == 2);
+	region_set_chunk(&region, 5, 5, &chunk);
+	assert(region.chunks_len == 2);
+	region_set_generating(&region, 6, 6, true);
+	region_set_chunk(&region, 5, 5, NULL);
+	region_set_chunk(&region, -2, -2, NULL);
+	assert(!region_is_empty(&region));
+	region_set_generating(&region, 6, 6, false);
+	assert(region_is_empty(&region));
+}
+
+void test_region_files()
+{
+	char dir[] = "/tmp/anvil-tests-XXXXXX";
+	assert(mkdtemp(dir) != NULL);
+	char path[64];
+	snprintf(path, sizeof(path), "%s/region", dir);
+	assert(mkdir(path, 0755) == 0);
+	for (int x = 0; x < 3; ++x) {
+		snprintf(path, sizeof(path), "%s/region/r.%d.0.mca", dir, x);
+		fclose(fopen(path, "w"));
+	}
+
+	struct region_files *files = region_files_new(2);
+	struct region *regions[3];
+	for (int x = 0; x < 3; ++x) {
+		assert(region_open(dir, x, 0, &regions[x]) == ANVIL_OK);
+		region_files_add(files, regions[x]);
+	}
+	/* the first one was the least recently used when the third opened */
+	assert(regions[0]->file == NULL && regions[0]->has_file);
+	assert(regions[1]->file != NULL && regions[2]->file != NULL);
+	assert(region_file(regions[0]) != NULL);
+	assert(regions[1]->file == NULL);
+	assert(region_file(regions[2]) != NULL);
+	assert(region_file(regions[1]) != NULL);
+	assert(regions[0]->file == NULL);
+
+	struct region *missing;
+	assert(region_open(dir, 5, 5, &missing) == ANVIL_OK);
+	region_files_add(files, missing);
+	assert(region_file(missing) == NULL && regions[2]->file != NULL);
+
+	free_region(missing);
+	for (int x = 0; x < 3; ++x) {
+		free_region(regions[x]);
+		snprintf(path, sizeof(path), "%s/region/r.%d.0.mca", dir, x);
+		unlink(path);
+	}
+	region_files_free(files);
+	snprintf(path, sizeof(path), "%s/region", dir);
+	rmdir(path);
+	rmdir(dir);
+}
+
+void test_section_pack_unpack()
+{
+	const int widths[] = { 4, 5, 6, 7, 8, 9, 14 };
+	uint16_t in[TOTAL_BLOCKSTATES];
+	uint16_t out[TOTAL_BLOCKSTATES];
+	for (size_t w = 0; w < sizeof(widths) / sizeof(widths[0]); ++w) {
+		struct section s = { .bits_per_block = widths[w] };
+		s.blockstates = calloc(BLOCKSTATES_LEN(s.bits_per_block),
+				       sizeof(uint64_t));
+		for (int i = 0; i < TOTAL_BLOCKSTATES; ++i)
+			in[i] = rand() & ((1 << s.bits_per_block) - 1);
+
+		section_pack(&s, in);
+		for (int i = 0; i < TOTAL_BLOCKSTATES; ++i)
+			assert(read_blockstate_at(&s, i % 16, i / 256,
+						  (i / 16) % 16)
+			       == in[i]);
+		section_unpack(&s, out);
+		assert(!memcmp(in, out, sizeof(in)));
+
+		// packing over an existing array shouldn't leave old bits
+		memset(in, 0, sizeof(in));
+		section_pack(&s, in);
+		section_unpack(&s, out);
+		assert(!memcmp(in, out, sizeof(in)));
+		free(s.blockstates);
+	}
+}
+
+void test_uniform_section()
+{
+	int palette[] = { 1, 2 };
+	struct section s = { .palette_len = 2, .bits_per_block = 4 };
+	s.palette = palette;
+	s.blockstates = calloc(BLOCKSTATES_LEN(4), sizeof(uint64_t));
+	write_blockstate_at(&s, 1, 2, 3, 1);
+	assert(section_uniform_index(&s) == -1);
+	assert(!section_is_uniform(&s));
+
+	// every block is palette[1] now
+	memset(s.blockstates, 0x11, sizeof(uint64_t) * BLOCKSTATES_LEN(4));
+	assert(section_uniform_index(&s) == 1);
+
+	free(s.blockstates);
+	s.blockstates = NULL;
+	assert(section_is_uniform(&s));
+	assert(read_blockstate_at(&s, 15, 15, 15) == 0);
+
+	// writing expands it again
+	write_blockstate_at(&s, 1, 2, 3, 1);
+	assert(!section_is_uniform(&s));
+	assert(read_blockstate_at(&s, 1, 2, 3) == 1);
+	assert(read_blockstate_at(&s, 3, 2, 1) == 0);
+	// and overwriting a block clears what was there before
+	write_blockstate_at(&s, 1, 2, 3, 0);
+	assert(read_blockstate_at(&s, 1, 2, 3) == 0);
+	free(s.blockstates);
+}
+
+void test_chunk_arena()
+{
+	struct chunk *c = chunk_new(16);
+	assert(c->sections[CHUNK_SECTION_INDEX(-1)].y == -1);
+	assert(c->sections[CHUNK_SECTION_INDEX(15)].bits_per_block == -1);
+	uint8_t *a = chunk_alloc(c, 1);
+	uint8_t *b = chunk_alloc(c, 8);
+	assert(a != NULL && b == a + 8);
+	assert(chunk_alloc(c, 1) == NULL);
+
+	// blockstates from outside of the arena get freed with the chunk
+	c->sections[1].blockstates = malloc(sizeof(uint64_t));
+	free_chunk(c);
+}
+
+void test_light_sharing()
+{
+	uint8_t light[SECTION_LIGHT_LEN];
+	memset(light, 0xff, SECTION_LIGHT_LEN);
+	size_t shared = light_shared_len();
+
+	uint8_t *l1 = light_intern(light);
+	uint8_t *l2 = light_intern(light);
+	assert(l1 != light && l1 == l2);
+	assert(light_shared_len() == shared + 1);
+
+	// writing to one section's light shouldn't touch the other's
+	l2 = light_make_writable(l2);
+	assert(l2 != l1);
+	l2[0] = 0;
+	assert(l1[0] == 0xff);
+
+	// the last user can write to it in place
+	assert(light_make_writable(l1) == l1);
+	assert(light_shared_len() == shared);
+	light_release(l1);
+	light_release(l2);
+}
+
+void test_light_share()
+{
+	uint8_t *lit = light_alloc(15);
+	assert(light_get(lit, 3, 4, 5) == 15);
+	lit = light_share(lit);
+
+	uint8_t *l = light_alloc(0);
+	light_set(l, 3, 4, 5, 7);
+	assert(light_get(l, 3, 4, 5) == 7);
+	assert(light_get(l, 2, 4, 5) == 0 && light_get(l, 4, 4, 5) == 0);
+	size_t shared = light_shared_len();
+	l = light_share(l);
+	assert(light_shared_len() == shared + 1);
+
+	// sharing a buffer that's been lit back up should dedupe it
+	uint8_t *l2 = light_make_writable(light_intern(l));
+	assert(light_shared_len() == shared + 1);
+	memset(l2, 0xff, SECTION_LIGHT_LEN);
+	assert(light_share(l2) == lit);
+	light_release(lit);
+	light_release(lit);
+	light_release(l);
+}
+
+static bool not_air(int block_id)
+{
+	return block_id != 0;
+}
+
+void test_heightmap()
+{
+	struct chunk *c = chunk_new(0);
+	int stone = 1;
+	int palette[] = { 0, 2 };
+	// a solid section at y=0, and one at y=1 with one block in it
+	c->sections_len = CHUNK_SECTION_INDEX(2);
+	struct section *s = &c->sections[CHUNK_SECTION_INDEX(0)];
+	s->palette_len = 1;
+	s->palette = &stone;
+	s->bits_per_block = MIN_BITS_PER_BLOCK;
+	s = &c->sections[CHUNK_SECTION_INDEX(1)];
+	s->palette_len = 2;
+	s->palette = palette;
+	s->bits_per_block = MIN_BITS_PER_BLOCK;
+	s->blockstates = calloc(BLOCKSTATES_LEN(4), sizeof(uint64_t));
+	write_blockstate_at(s, 3, 4, 5, 1);
+
+	chunk_compute_heightmap(c, not_air);
+	assert(chunk_height_at(c, 0, 0) == 16);
+	assert(chunk_height_at(c, 3, 5) == 21);
+	// block coords outside of the chunk wrap around
+	assert(chunk_height_at(c, -13, 21) == 21);
+
+	palette[1] = 0;
+	chunk_update_heightmap(c, 3, 20, 5, not_air);
+	assert(chunk_height_at(c, 3, 5) == 16);
+	palette[1] = 2;
+	chunk_update_heightmap(c, 3, 20, 5, not_air);
+	assert(chunk_height_at(c, 3, 5) == 21);
+	assert(chunk_height_at(c, 4, 5) == 16);
+	free_chunk(c);
+}
+
+static const char *test_blocks[] = { "minecraft:air", "minecraft:stone",
+				     "minecraft:water;level=5" };
+
+static const char *test_block_name(int block_id)
+{
+	if (block_id < 0 || block_id >= 3)
+		return NULL;
+	return test_blocks[block_id];
+}
+
+/* inflates and parses a chunk the way anvil_encode_chunk() left it */
+static struct chunk *decode_chunk(struct hashmap *block_table, uint8_t *data,
+				  size_t len)
+{
+	uint8_t *nbt = NULL;
+	size_t cap = 0;
+	size_t nbt_len;
+	assert(zpool_inflate(data, len, 0, &nbt, &cap, &nbt_len) == ANVIL_OK);
+	struct chunk *c;
+	assert(anvil_parse_chunk(block_table, nbt_len, nbt, &c) == ANVIL_OK);
+	free(nbt);
+	return c;
+}
+
+static void assert_chunks_equal(const struct chunk *a, const struct chunk *b)
+{
+	assert(a->sections_len == b->sections_len);
+	for (int x = 0; x < 16; ++x)
+		for (int y = -16; y < 32; ++y)
+			for (int z = 0; z < 16; ++z)
+				assert(chunk_block_at(a, x, y, z)
+				       == chunk_block_at(b, x, y, z));
+	assert(memcmp(a->biomes, b->biomes, BIOMES_LEN) == 0);
+	assert(a->has_heightmap == b->has_heightmap);
+	assert(memcmp(a->heightmap, b->heightmap, sizeof(a->heightmap)) == 0);
+	for (int i = 0; i < a->sections_len; ++i) {
+		const uint8_t *la = a->sections[i].sky_light;
+		const uint8_t *lb = b->sections[i].sky_light;
+		assert((la == NULL) == (lb == NULL));
+		assert(la == NULL || memcmp(la, lb, SECTION_LIGHT_LEN) == 0);
+	}
+}
+
+void test_encode_round_trip()
+{
+	struct hashmap *block_table = hashmap_new(8);
+	for (int i = 0; i < 3; ++i) {
+		int *id = malloc(sizeof(int));
+		*id = i;
+		hashmap_add(block_table, strdup(test_blocks[i]), id);
+	}
+
+	struct chunk *c = chunk_new(0);
+	int stone = 1;
+	int palette[] = { 0, 1, 2 };
+	// a uniform section at y=0, and a mixed one with light above it
+	c->sections_len = CHUNK_SECTION_INDEX(2);
+	struct section *s = &c->sections[CHUNK_SECTION_INDEX(0)];
+	s->palette_len = 1;
+	s->palette = &stone;
+	s->bits_per_block = MIN_BITS_PER_BLOCK;
+	s = &c->sections[CHUNK_SECTION_INDEX(1)];
+	s->palette_len = 3;
+	s->palette = palette;
+	s->bits_per_block = MIN_BITS_PER_BLOCK;
+	s->blockstates = calloc(BLOCKSTATES_LEN(4), sizeof(uint64_t));
+	write_blockstate_at(s, 3, 4, 5, 1);
+	write_blockstate_at(s, 15, 15, 15, 2);
+	s->sky_light = light_alloc(0);
+	light_set(s->sky_light, 3, 5, 5, 14);
+	for (int i = 0; i < BIOMES_LEN; ++i)
+		c->biomes[i] = i % 7;
+	chunk_compute_heightmap(c, not_air);
+
+	uint8_t *encoded;
+	size_t encoded_len;
+	assert(anvil_encode_chunk(c, 3, -2, test_block_name, &encoded,
+				  &encoded_len)
+	       == ANVIL_OK);
+	struct chunk *decoded = decode_chunk(block_table, encoded, encoded_len);
+	free(encoded);
+	assert_chunks_equal(c, decoded);
+	assert(chunk_block_at(decoded, 3, 20, 5) == 1);
+	assert(chunk_block_at(decoded, 15, 31, 15) == 2);
+
+	// and again, so nothing the decoder adds gets lost either
+	assert(anvil_encode_chunk(decoded, 3, -2, test_block_name, &encoded,
+				  &encoded_len)
+	       == ANVIL_OK);
+	struct chunk *redecoded =
+	    decode_chunk(block_table, encoded, encoded_len);
+	free(encoded);
+	assert_chunks_equal(decoded, redecoded);
+
+	free_chunk(redecoded);
+	free_chunk(decoded);
+	free_chunk(c);
+	hashmap_free(block_table, true, free);
 }
 
 int main()
 {
 	test_region();
+	test_region_files();
+	test_section_pack_unpack();
+	test_uniform_section();
+	test_chunk_arena();
+	test_light_sharing();
+	test_light_share();
+	test_heightmap();
+	test_encode_round_trip();
 }
@@ -0,0 +1,255 @@
+#include "zpool.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef HAVE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
+/* more idle streams than this just get freed, there's no point keeping more
+ * than there are threads using them */
+#define IDLE_MAX 32
+
+struct idle {
+	void *items[IDLE_MAX];
+	int len;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	struct idle inflaters;
+	struct idle deflaters;
+#ifdef HAVE_LIBDEFLATE
+	struct idle decompressors;
+#endif
+} pool = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/* returns an idle item, or NULL if there aren't any */
+static void *take(struct idle *idle)
+{
+	void *item = NULL;
+	pthread_mutex_lock(&pool.lock);
+	if (idle->len > 0)
+		item = idle->items[--idle->len];
+	pthread_mutex_unlock(&pool.lock);
+	return item;
+}
+
+/* returns false if there's no room for it, in which case it should be
+ * freed */
+static bool give(struct idle *idle, void *item)
+{
+	bool kept = false;
+	pthread_mutex_lock(&pool.lock);
+	if (idle->len < IDLE_MAX) {
+		idle->items[idle->len++] = item;
+		kept = true;
+	}
+	pthread_mutex_unlock(&pool.lock);
+	return kept;
+}
+
+z_stream *zpool_take_inflate()
+{
+	z_stream *s = take(&pool.inflaters);
+	if (s != NULL) {
+		inflateReset(s);
+		return s;
+	}
+	s = calloc(1, sizeof(z_stream));
+	if (s == NULL)
+		return NULL;
+	int z_err = inflateInit(s);
+	if (z_err != Z_OK) {
+		fprintf(stderr, "zlib error: %d\n", z_err);
+		free(s);
+		return NULL;
+	}
+	return s;
+}
+
+static void free_inflate(void *s)
+{
+	inflateEnd(s);
+	free(s);
+}
+
+void zpool_give_inflate(z_stream *s)
+{
+	if (!give(&pool.inflaters, s))
+		free_inflate(s);
+}
+
+z_stream *zpool_take_deflate()
+{
+	z_stream *s = take(&pool.deflaters);
+	if (s != NULL) {
+		deflateReset(s);
+		return s;
+	}
+	s = calloc(1, sizeof(z_stream));
+	if (s == NULL)
+		return NULL;
+	int z_err = deflateInit(s, Z_DEFAULT_COMPRESSION);
+	if (z_err != Z_OK) {
+		fprintf(stderr, "zlib error: %d\n", z_err);
+		free(s);
+		return NULL;
+	}
+	return s;
+}
+
+static void free_deflate(void *s)
+{
+	deflateEnd(s);
+	free(s);
+}
+
+void zpool_give_deflate(z_stream *s)
+{
+	if (!give(&pool.deflaters, s))
+		free_deflate(s);
+}
+
+static enum anvil_err grow(uint8_t **buf, size_t *cap, size_t new_cap)
+{
+	uint8_t *new_buf = realloc(*buf, new_cap);
+	if (new_buf == NULL)
+		return ANVIL_NO_MEMORY;
+	*buf = new_buf;
+	*cap = new_cap;
+	return ANVIL_OK;
+}
+
+#ifdef HAVE_LIBDEFLATE
+static enum anvil_err inflate_all(const uint8_t *in, size_t in_len,
+				  uint8_t **out, size_t *out_cap,
+				  size_t *out_len)
+{
+	struct libdeflate_decompressor *d = take(&pool.decompressors);
+	if (d == NULL && (d = libdeflate_alloc_decompressor()) == NULL)
+		return ANVIL_NO_MEMORY;
+
+	enum anvil_err err = ANVIL_OK;
+	enum libdeflate_result result;
+	/* libdeflate can't carry on where it left off, so running out of
+	 * room means starting over with twice as much */
+	while ((result = libdeflate_zlib_decompress(d, in, in_len, *out,
+						    *out_cap, out_len))
+	       == LIBDEFLATE_INSUFFICIENT_SPACE) {
+		if ((err = grow(out, out_cap, *out_cap * 2)) != ANVIL_OK)
+			break;
+	}
+	if (err == ANVIL_OK && result != LIBDEFLATE_SUCCESS) {
+		fprintf(stderr, "libdeflate error: %d\n", result);
+		err = ANVIL_ZLIB_ERROR;
+	}
+	if (!give(&pool.decompressors, d))
+		libdeflate_free_decompressor(d);
+	return err;
+}
+#else
+static enum anvil_err inflate_all(const uint8_t *in, size_t in_len,
+				  uint8_t **out, size_t *out_cap,
+				  size_t *out_len)
+{
+	z_stream *s = zpool_take_inflate();
+	if (s == NULL)
+		return ANVIL_ZLIB_ERROR;
+
+	enum anvil_err err = ANVIL_OK;
+	s->next_in = (Bytef *) in;
+	s->avail_in = in_len;
+	s->next_out = *out;
+	s->avail_out = *out_cap;
+	int z_err;
+	while ((z_err = inflate(s, Z_NO_FLUSH)) != Z_STREAM_END) {
+		/* anything but running out of room means it's broken, or
+		 * the input ended early */
+		if ((z_err != Z_OK && z_err != Z_BUF_ERROR)
+		    || s->avail_out > 0) {
+			fprintf(stderr, "zlib inflate error: %d\n", z_err);
+			err = ANVIL_ZLIB_ERROR;
+			break;
+		}
+		if ((err = grow(out, out_cap, *out_cap * 2)) != ANVIL_OK)
+			break;
+		s->next_out = *out + s->total_out;
+		s->avail_out = *out_cap - s->total_out;
+	}
+	*out_len = s->total_out;
+	zpool_give_inflate(s);
+	return err;
+}
+#endif
+
+enum anvil_err zpool_inflate(const uint8_t *in, size_t in_len,
+			     size_t size_hint, uint8_t **out, size_t *out_cap,
+			     size_t *out_len)
+{
+	if (size_hint < 4096)
+		size_hint = 4096;
+	if (*out_cap < size_hint) {
+		enum anvil_err err = grow(out, out_cap, size_hint);
+		if (err != ANVIL_OK)
+			return err;
+	}
+	return inflate_all(in, in_len, out, out_cap, out_len);
+}
+
+enum anvil_err zpool_deflate(const uint8_t *in, size_t in_len, uint8_t **out,
+			     size_t *out_len)
+{
+	z_stream *s = zpool_take_deflate();
+	if (s == NULL)
+		return ANVIL_ZLIB_ERROR;
+	size_t cap = deflateBound(s, in_len);
+	uint8_t *buf = malloc(cap);
+	if (buf == NULL) {
+		zpool_give_deflate(s);
+		return ANVIL_NO_MEMORY;
+	}
+
+	s->next_in = (Bytef *) in;
+	s->avail_in = in_len;
+	s->next_out = buf;
+	s->avail_out = cap;
+	/* deflateBound() is enough room to do it in one go */
+	int z_err = deflate(s, Z_FINISH);
+	*out_len = s->total_out;
+	zpool_give_deflate(s);
+	if (z_err != Z_STREAM_END) {
+		fprintf(stderr, "zlib deflate error: %d\n", z_err);
+		free(buf);
+		return ANVIL_ZLIB_ERROR;
+	}
+	*out = buf;
+	return ANVIL_OK;
+}
+
+static void free_idle(struct idle *idle, void (*free_item)(void *))
+{
+	while (idle->len > 0)
+		free_item(idle->items[--idle->len]);
+}
+
+#ifdef HAVE_LIBDEFLATE
+static void free_decompressor(void *d)
+{
+	libdeflate_free_decompressor(d);
+}
+#endif
+
+void zpool_free()
+{
+	pthread_mutex_lock(&pool.lock);
+	free_idle(&pool.inflaters, free_inflate);
+	free_idle(&pool.deflaters, free_deflate);
+#ifdef HAVE_LIBDEFLATE
+	free_idle(&pool.decompressors, free_decompressor);
+#endif
+	pthread_mutex_unlock(&pool.lock);
+}
@@ -151,6 +151,9 @@ void *hashmap_remove(struct hashmap *hm, char *key)
 	if (i != hm->entries_len) {
 		hm->entries[i].removed = true;
 		free(hm->entries[i].key);
+		/* removed entries are skipped over when looking keys up, but
+		 * are free to be added to again */
+		hm->entries[i].key = NULL;
 		void *value = hm->entries[i].value;
 		hm->entries[i].value = NULL;
 		--(hm->occupied);
@@ -77,11 +77,12 @@ struct list *list_find(struct list *list, bool (*equal)(void *, void *),
 
 int list_len(struct list *list)
 {
-	if (list_empty(list)) {
-		return 0;
-	} else {
-		return 1 + list_len(list->next);
+	int len = 0;
+	while (!list_empty(list)) {
+		++len;
+		list = list_next(list);
 	}
+	return len;
 }
 
 void list_free(struct list *list)
@@ -209,7 +209,7 @@ static int nbt_read_array(struct nbt_array *a, size_t elem_bytes, size_t len,
 static int nbt_read_int_array(struct nbt_array **array, size_t len,
 			      const uint8_t *data)
 {
-	struct nbt_array *a = malloc(sizeof(struct nbt_array));
+	struct nbt_array *a = calloc(1, sizeof(struct nbt_array));
 	a->type = TAG_Int_Array;
 	int n = nbt_read_array(a, 4, len, data);
 	for (int32_t i = 0; i < a->len; ++i) {
@@ -222,7 +222,7 @@ static int nbt_read_int_array(struct nbt_array **array, size_t len,
 static int nbt_read_long_array(struct nbt_array **array, size_t len,
 			       const uint8_t *data)
 {
-	struct nbt_array *a = malloc(sizeof(struct nbt_array));
+	struct nbt_array *a = calloc(1, sizeof(struct nbt_array));
 	a->type = TAG_Long_Array;
 	int n = nbt_read_array(a, 8, len, data);
 	for (int32_t i = 0; i < a->len; ++i) {
@@ -0,0 +1,35 @@
+/* an intrusive first in, first out queue. whatever goes in it has a struct
+ * queue_node in it somewhere, so adding to it never allocates, and pushing
+ * onto the back and popping off the front are both O(1). a zeroed struct
+ * queue is empty */
+#ifndef CHOWDER_QUEUE_H
+#define CHOWDER_QUEUE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct queue_node {
+	struct queue_node *next;
+};
+
+struct queue {
+	struct queue_node *head;
+	struct queue_node *tail;
+	size_t len;
+};
+
+/* gets the struct a node's in back from the node, MEMBER is the name of the
+ * node in it */
+#define QUEUE_ITEM(NODE, TYPE, MEMBER)                                         \
+	((TYPE *) ((char *) (NODE) - offsetof(TYPE, MEMBER)))
+
+void queue_init(struct queue *);
+void queue_push(struct queue *, struct queue_node *);
+/* returns NULL if it's empty */
+struct queue_node *queue_pop(struct queue *);
+/* returns NULL if it's empty */
+struct queue_node *queue_peek(const struct queue *);
+bool queue_empty(const struct queue *);
+size_t queue_len(const struct queue *);
+
+#endif // CHOWDER_QUEUE_H
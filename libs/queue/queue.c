@@ -0,0 +1,46 @@
+#include "queue.h"
+
+void queue_init(struct queue *q)
+{
+	q->head = NULL;
+	q->tail = NULL;
+	q->len = 0;
+}
+
+void queue_push(struct queue *q, struct queue_node *node)
+{
+	node->next = NULL;
+	if (q->tail == NULL)
+		q->head = node;
+	else
+		q->tail->next = node;
+	q->tail = node;
+	++q->len;
+}
+
+struct queue_node *queue_pop(struct queue *q)
+{
+	struct queue_node *node = q->head;
+	if (node == NULL)
+		return NULL;
+	q->head = node->next;
+	if (q->head == NULL)
+		q->tail = NULL;
+	--q->len;
+	return node;
+}
+
+struct queue_node *queue_peek(const struct queue *q)
+{
+	return q->head;
+}
+
+bool queue_empty(const struct queue *q)
+{
+	return q->head == NULL;
+}
+
+size_t queue_len(const struct queue *q)
+{
+	return q->len;
+}
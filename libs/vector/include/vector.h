@@ -0,0 +1,33 @@
+/* a growable array, with the items stored in it rather than pointed to, so
+ * going through them is just walking memory. growing it can move the items,
+ * so pointers into it only last until the next vector_push() */
+#ifndef CHOWDER_VECTOR_H
+#define CHOWDER_VECTOR_H
+
+#include <stddef.h>
+
+struct vector {
+	void *items;
+	size_t item_size;
+	size_t len;
+	size_t cap;
+};
+
+/* the item at i, as the given type */
+#define VECTOR_AT(V, TYPE, I) (((TYPE *) (V)->items)[I])
+
+/* a vector doesn't allocate anything until the first push */
+void vector_init(struct vector *, size_t item_size);
+/* frees the vector's own memory, not anything its items point to */
+void vector_free(struct vector *);
+
+/* copies the item onto the end, returns 0 on success or -1 if there's no
+ * memory for it */
+int vector_push(struct vector *, const void *item);
+void *vector_at(const struct vector *, size_t i);
+/* moves the last item into its place, so it's O(1) but doesn't keep them in
+ * order */
+void vector_swap_remove(struct vector *, size_t i);
+void vector_clear(struct vector *);
+
+#endif // CHOWDER_VECTOR_H
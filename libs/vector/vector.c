@@ -0,0 +1,51 @@
+#include "vector.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_CAP 8
+
+void vector_init(struct vector *v, size_t item_size)
+{
+	v->items = NULL;
+	v->item_size = item_size;
+	v->len = 0;
+	v->cap = 0;
+}
+
+void vector_free(struct vector *v)
+{
+	free(v->items);
+	vector_init(v, v->item_size);
+}
+
+int vector_push(struct vector *v, const void *item)
+{
+	if (v->len == v->cap) {
+		size_t cap = v->cap == 0 ? INITIAL_CAP : v->cap * 2;
+		void *items = realloc(v->items, cap * v->item_size);
+		if (items == NULL)
+			return -1;
+		v->items = items;
+		v->cap = cap;
+	}
+	memcpy(vector_at(v, v->len++), item, v->item_size);
+	return 0;
+}
+
+void *vector_at(const struct vector *v, size_t i)
+{
+	return (uint8_t *) v->items + i * v->item_size;
+}
+
+void vector_swap_remove(struct vector *v, size_t i)
+{
+	if (--v->len != i)
+		memcpy(vector_at(v, i), vector_at(v, v->len), v->item_size);
+}
+
+void vector_clear(struct vector *v)
+{
+	v->len = 0;
+}
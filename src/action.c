@@ -5,34 +5,44 @@
 
 #include <stdlib.h>
 
-#define ACTION_CONF(PACKET_NAME, FREE, SENDS_MSG)                              \
-	[PROTOCOL_ID_##                                                        \
-	    PACKET_NAME] = { #PACKET_NAME,                                     \
-			     (protocol_read_func) protocol_read_##PACKET_NAME, \
-			     protocol_act_##PACKET_NAME, FREE, SENDS_MSG }
-#define ACTION(PACKET_NAME) ACTION_CONF(PACKET_NAME, free, false)
+#define ACTION_CONF(PACKET_NAME, FREE, SENDS_MSG, COALESCE)                    \
+	[PROTOCOL_ID_##PACKET_NAME] = {                                        \
+		#PACKET_NAME,                                                  \
+		(protocol_read_func) protocol_read_##PACKET_NAME,              \
+		protocol_act_##PACKET_NAME,                                    \
+		FREE,                                                          \
+		SENDS_MSG,                                                     \
+		COALESCE                                                       \
+	}
+#define ACTION(PACKET_NAME) ACTION_CONF(PACKET_NAME, free, false, false)
 #define ACTIONF(PACKET_NAME)                                                   \
-	ACTION_CONF(PACKET_NAME, protocol_free_##PACKET_NAME, false)
-#define ACTIONM(PACKET_NAME) ACTION_CONF(PACKET_NAME, free, true)
+	ACTION_CONF(PACKET_NAME, protocol_free_##PACKET_NAME, false, false)
+#define ACTIONM(PACKET_NAME) ACTION_CONF(PACKET_NAME, free, true, false)
 #define ACTIONMF(PACKET_NAME)                                                  \
-	ACTION_CONF(PACKET_NAME, protocol_free_##PACKET_NAME, true)
+	ACTION_CONF(PACKET_NAME, protocol_free_##PACKET_NAME, true, false)
+/* latest wins, see protocol_action.coalesce */
+#define ACTIONC(PACKET_NAME) ACTION_CONF(PACKET_NAME, free, false, true)
+#define ACTIONCF(PACKET_NAME)                                                  \
+	ACTION_CONF(PACKET_NAME, protocol_free_##PACKET_NAME, false, true)
 
 struct protocol_action protocol_actions[UINT8_MAX] = {
 	ACTION(teleport_confirm),
 	ACTION(sb_keep_alive),
 	ACTION(player_block_placement),
 	ACTIONMF(sb_chat_message),
-	ACTION(player_position),
-	ACTION(sb_player_position_rotation),
+	ACTIONC(player_position),
+	ACTIONC(sb_player_position_rotation),
+	ACTIONC(player_rotation),
+	ACTIONCF(client_settings),
 };
 
-#define MSG_ACTION(PACKET_NAME, OUT_PACKET_NAME)                               \
+#define MSG_ACTION(PACKET_NAME, OUT_PACKET_NAME, SCOPE)                        \
 	[PROTOCOL_ID_##PACKET_NAME] = {                                        \
 		#PACKET_NAME, message_to_packet_##PACKET_NAME,                 \
 		(protocol_write_func) protocol_write_##OUT_PACKET_NAME,        \
-		protocol_free_##OUT_PACKET_NAME                                \
+		protocol_free_##OUT_PACKET_NAME, SCOPE                         \
 	}
 
 struct message_action message_actions[UINT8_MAX] = {
-	MSG_ACTION(sb_chat_message, cb_chat_message),
+	MSG_ACTION(sb_chat_message, cb_chat_message, MESSAGE_GLOBAL),
 };
@@ -19,15 +19,29 @@ struct protocol_action {
 	protocol_act_func act;
 	protocol_free_func free;
 	bool sends_message;
+	/* only the newest one a client sends each tick gets acted on, for
+	 * packets that just say what the state is now. they're acted on after
+	 * everything else the client sent that tick has been read */
+	bool coalesce;
 };
 
 typedef void *(*message_to_packet_func)(struct message *);
 
+/* who gets sent a message */
+enum message_scope {
+	/* everyone on the server */
+	MESSAGE_GLOBAL,
+	/* everyone close enough to see the player it's from, apart from that
+	 * player */
+	MESSAGE_NEARBY,
+};
+
 struct message_action {
 	const char *name;
 	message_to_packet_func message_to_packet;
 	protocol_write_func write;
 	protocol_free_func free;
+	enum message_scope scope;
 };
 
 extern struct protocol_action protocol_actions[UINT8_MAX];
@@ -0,0 +1,23 @@
+#include "client_settings.h"
+#include "conn.h"
+#include "world.h"
+
+#include <stdlib.h>
+
+void protocol_act_client_settings(struct conn *conn, struct world *world,
+				  void *data)
+{
+	(void) world;
+
+	/* the view itself gets resized a bit at a time by
+	 * server_adjust_view_distances() */
+	struct client_settings *settings = data;
+	conn_set_client_view_distance(conn, settings->view_distance);
+}
+
+void protocol_free_client_settings(void *data)
+{
+	struct client_settings *settings = data;
+	free(settings->locale);
+	free(settings);
+}
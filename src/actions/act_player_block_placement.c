@@ -1,6 +1,10 @@
+#include "blocks.h"
 #include "chunk.h"
 #include "conn.h"
+#include "lighting.h"
+#include "mc.h"
 #include "player_block_placement.h"
+#include "server.h"
 #include "world.h"
 
 #include <stdint.h>
@@ -15,8 +19,7 @@ static void mc_position_to_xyz(uint64_t pos, int32_t *x, int16_t *y, int32_t *z)
 void protocol_act_player_block_placement(struct conn *conn, struct world *world,
 					 void *data)
 {
-	(void) conn;
-
+	server_player_active(conn, world);
 	struct player_block_placement *block_placement = data;
 	int32_t x, z;
 	int16_t y;
@@ -41,13 +44,17 @@ void protocol_act_player_block_placement(struct conn *conn, struct world *world,
 		++x;
 		break;
 	}
-	struct chunk *chunk = world_chunk_at(world, x, z);
-	int i = (y / 16) + 1;
-	if (i < chunk->sections_len && chunk->sections[i]->bits_per_block > 0) {
+	struct chunk *chunk =
+	    world_chunk_at(world, mc_coord_to_chunk(x), mc_coord_to_chunk(z));
+	int i = CHUNK_SECTION_INDEX(y / 16);
+	if (i < chunk->sections_len && chunk->sections[i].bits_per_block > 0) {
+		struct section *section = &chunk->sections[i];
 		printf("INFO: writing blockstate to (%d,%d,%d)\n", x, y, z);
 		/* TODO: track what the player is holding and write that block
 		 *       instead of some random block from the palette */
-		write_blockstate_at(chunk->sections[i], x, y, z,
-				    chunk->sections[i]->palette_len - 1);
+		write_blockstate_at(section, x & 15, y & 15, z & 15,
+				    section->palette_len - 1);
+		chunk_update_heightmap(chunk, x, y, z, block_blocks_motion);
+		lighting_block_changed(world, x, y, z);
 	}
 }
@@ -1,17 +1,27 @@
 #include "conn.h"
-#include "mc.h"
+#include "entities.h"
+#include "interest.h"
 #include "player_position.h"
+#include "server.h"
 #include "world.h"
 
 void protocol_act_player_position(struct conn *conn, struct world *world,
 				  void *data)
 {
-	(void) world;
-
 	struct player_position *position = data;
-	conn_update_view_position_if_needed(conn, position->x, position->z);
-	conn->player->x = position->x;
-	conn->player->y = position->feet_y;
-	conn->player->z = position->z;
-	// FIXME: track on_ground
+	struct entities *entities = world_entities(world);
+	int handle = conn->player->entity;
+	int i = ENTITY_INDEX(entities, handle);
+	/* clients send their position every second even when they're
+	 * standing still */
+	if (position->x != entities->x[i] || position->feet_y != entities->y[i]
+	    || position->z != entities->z[i])
+		server_player_active(conn, world);
+	conn_update_view_position_if_needed(conn, entities->c_x[i],
+					    entities->c_z[i], position->x,
+					    position->z);
+	entities_move(entities, handle, position->x, position->feet_y,
+		      position->z, position->on_ground);
+	interest_grid_update(world_interest(world), conn, entities->c_x[i],
+			     entities->c_z[i]);
 }
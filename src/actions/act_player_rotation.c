@@ -0,0 +1,18 @@
+#include "conn.h"
+#include "entities.h"
+#include "player_rotation.h"
+#include "server.h"
+#include "world.h"
+
+void protocol_act_player_rotation(struct conn *conn, struct world *world,
+				  void *data)
+{
+	struct player_rotation *rotation = data;
+	struct entities *entities = world_entities(world);
+	int i = ENTITY_INDEX(entities, conn->player->entity);
+	if (rotation->yaw != entities->yaw[i]
+	    || rotation->pitch != entities->pitch[i])
+		server_player_active(conn, world);
+	entities_rotate(entities, conn->player->entity, rotation->yaw,
+			rotation->pitch, rotation->on_ground);
+}
@@ -2,6 +2,7 @@
 #include "conn.h"
 #include "message.h"
 #include "sb_chat_message.h"
+#include "server.h"
 #include "strutil.h"
 #include "world.h"
 
@@ -10,8 +11,7 @@
 void protocol_act_sb_chat_message(struct conn *conn, struct world *world,
 				  void *data)
 {
-	(void) world;
-
+	server_player_active(conn, world);
 	struct sb_chat_message *chat_message = data;
 	printf("<%s> %s\n", conn->player->username, chat_message->message);
 }
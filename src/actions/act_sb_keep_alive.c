@@ -1,15 +1,13 @@
 #include "conn.h"
 #include "sb_keep_alive.h"
+#include "server.h"
 #include "world.h"
 
 #include <stdio.h>
-#include <time.h>
 
 void protocol_act_sb_keep_alive(struct conn *conn, struct world *world,
 				void *data)
 {
-	(void) world;
-
 	struct sb_keep_alive *keep_alive = data;
 	if (keep_alive->keep_alive_id != conn->keep_alive_id) {
 		fprintf(stderr,
@@ -17,6 +15,6 @@ void protocol_act_sb_keep_alive(struct conn *conn, struct world *world,
 			"\tgot %ld\n\texpected %ld\n",
 			keep_alive->keep_alive_id, conn->keep_alive_id);
 	} else {
-		conn->last_pong = time(NULL);
+		server_keep_alive_answered(conn, world);
 	}
 }
@@ -14,5 +14,8 @@ void protocol_act_teleport_confirm(struct conn *conn, struct world *world,
 		fprintf(stderr,
 			"teleport id mismatch\n\tconfirm = %d\n\treal=%d\n",
 			confirm->teleport_id, conn->teleport_id);
+	} else {
+		/* it's finished joining */
+		timer_cancel(&conn->join_timer);
 	}
 }
@@ -177,3 +177,60 @@ struct hashmap *create_block_table(char *block_json_path)
 	free(json_str);
 	return block_table;
 }
+
+bool block_is_air(int block_id)
+{
+	/* TODO: don't hardcode these */
+	return block_id == 0 || block_id == 9129 || block_id == 9130;
+}
+
+bool block_blocks_motion(int block_id)
+{
+	/* FIXME: flowers, torches etc. don't block motion either */
+	return !block_is_air(block_id);
+}
+
+int block_light_emission(int block_id)
+{
+	/* TODO: don't hardcode these either */
+	if ((block_id >= 50 && block_id <= 65)           // lava
+	    || (block_id >= 1439 && block_id <= 1950)    // fire
+	    || (block_id >= 4006 && block_id <= 4009)    // jack o'lantern
+	    || (block_id >= 11230 && block_id <= 11231)) // lantern
+		return 15;
+	else if (block_id >= 1434 && block_id <= 1438) // torch, wall torch
+		return 14;
+	else if (block_id >= 8522 && block_id <= 8527) // end rod
+		return 14;
+
+	switch (block_id) {
+	case 3999: // glowstone
+	case 5640: // beacon
+	case 7326: // sea lantern
+		return 15;
+	case 8717: // magma block
+		return 3;
+	default:
+		return 0;
+	}
+}
+
+int block_light_opacity(int block_id)
+{
+	/* FIXME: like block_blocks_motion(), this treats most blocks that
+	 *        aren't full cubes (slabs, stairs, fences...) as opaque */
+	if (block_is_air(block_id))
+		return 0;
+	else if ((block_id >= 34 && block_id <= 49)       // water
+		 || (block_id >= 144 && block_id <= 227)) // leaves
+		return 1;
+	else if (block_id == 230                            // glass
+		 || (block_id >= 1340 && block_id <= 1346)  // cobweb, grass...
+		 || (block_id >= 1411 && block_id <= 1425)  // flowers
+		 || (block_id >= 1434 && block_id <= 1950)  // torches, fire
+		 || (block_id >= 3919 && block_id <= 3926)  // snow layers
+		 || (block_id >= 7357 && block_id <= 7358)) // tall grass
+		return 0;
+	else
+		return 15;
+}
@@ -3,6 +3,8 @@
 
 #include "hashmap.h"
 
+#include <stdbool.h>
+
 #ifdef BLOCK_NAMES
 extern size_t block_names_len;
 extern char **block_names;
@@ -12,4 +14,13 @@ void free_block_names();
 
 struct hashmap *create_block_table(char *block_json_path);
 
+bool block_is_air(int block_id);
+/* whether a block counts towards the MOTION_BLOCKING heightmap */
+bool block_blocks_motion(int block_id);
+/* how much light a block gives off, 0-15 */
+int block_light_emission(int block_id);
+/* how much light is lost passing through a block, 0-15. light always loses
+ * at least 1 per block anyway */
+int block_light_opacity(int block_id);
+
 #endif
@@ -0,0 +1,226 @@
+#include "chunk_index.h"
+
+#include "hashmap.h"
+#include "mc.h"
+#include "pool.h"
+#include "strutil.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define HEADER_LEN 4096
+
+struct region_entry {
+	/* the file's there but its header couldn't be read, so any chunk in
+	 * it might be saved */
+	bool unknown;
+	/* how many chunks are saved in it */
+	int len;
+	/* a bit for every chunk, z is the index and x is the bit */
+	uint32_t present[32];
+	/* indexed by x + z * 32, 0 for chunks that aren't there */
+	uint8_t sectors[1024];
+};
+
+struct chunk_index {
+	/* region entries keyed by "x,z", regions without a file aren't in
+	 * it */
+	struct hashmap *regions;
+};
+
+struct scan_job {
+	char *path;
+	int r_x;
+	int r_z;
+	struct region_entry *entry;
+};
+
+/* reads a region file's location table, leaving job->entry NULL if there
+ * wasn't room for it. one that can't be read is marked unknown, not empty */
+static void scan_region(void *data)
+{
+	struct scan_job *job = data;
+	job->entry = calloc(1, sizeof(struct region_entry));
+	if (job->entry == NULL)
+		return;
+	int fd = open(job->path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "chunk index: can't open \"%s\": %s\n",
+			job->path, strerror(errno));
+		job->entry->unknown = true;
+		return;
+	}
+	uint8_t header[HEADER_LEN];
+	ssize_t n = pread(fd, header, HEADER_LEN, 0);
+	if (n < 0) {
+		fprintf(stderr, "chunk index: can't read \"%s\": %s\n",
+			job->path, strerror(errno));
+		job->entry->unknown = true;
+	}
+	close(fd);
+	/* a file too short to have a header has no chunks in it */
+	for (int i = 0; n == HEADER_LEN && i < 1024; ++i) {
+		const uint8_t *loc = header + i * 4;
+		uint32_t offset = loc[0] << 16 | loc[1] << 8 | loc[2];
+		/* the first two sectors are the header itself */
+		if (offset < 2 || loc[3] == 0)
+			continue;
+		job->entry->present[i / 32] |= 1u << (i % 32);
+		job->entry->sectors[i] = loc[3];
+		++job->entry->len;
+	}
+}
+
+static void free_scan_job(void *data)
+{
+	struct scan_job *job = data;
+	free(job->path);
+	free(job->entry);
+	free(job);
+}
+
+static char *region_key(int r_x, int r_z)
+{
+	char *key;
+	if (asprintf(&key, "%d,%d", r_x, r_z) < 0)
+		return NULL;
+	return key;
+}
+
+/* submits a job for every region file in the directory, returns how many
+ * there were or -1 */
+static int submit_scans(struct pool *pool, const char *region_dir)
+{
+	DIR *dir = opendir(region_dir);
+	if (dir == NULL)
+		return errno == ENOENT ? 0 : -1;
+	int submitted = 0;
+	struct dirent *dirent;
+	while ((dirent = readdir(dir)) != NULL) {
+		int r_x, r_z, len = 0;
+		if (sscanf(dirent->d_name, "r.%d.%d.mca%n", &r_x, &r_z, &len)
+			!= 2
+		    || dirent->d_name[len] != '\0' || len == 0)
+			continue;
+		struct scan_job *job = calloc(1, sizeof(struct scan_job));
+		if (job == NULL)
+			break;
+		job->r_x = r_x;
+		job->r_z = r_z;
+		if (asprintf(&job->path, "%s/%s", region_dir, dirent->d_name)
+			< 0
+		    || pool_submit(pool, scan_region, job) < 0) {
+			free_scan_job(job);
+			break;
+		}
+		++submitted;
+	}
+	closedir(dir);
+	return submitted;
+}
+
+struct chunk_index *chunk_index_new(const char *world_path, int threads)
+{
+	struct chunk_index *index = malloc(sizeof(struct chunk_index));
+	char *region_dir;
+	if (index == NULL)
+		return NULL;
+	if (asprintf(&region_dir, "%s/region", world_path) < 0) {
+		free(index);
+		return NULL;
+	}
+	struct pool *pool = pool_new(threads);
+	if (pool == NULL) {
+		free(region_dir);
+		free(index);
+		return NULL;
+	}
+	index->regions = hashmap_new(1);
+
+	int left = submit_scans(pool, region_dir);
+	if (left < 0) {
+		fprintf(stderr, "chunk index: can't read \"%s\": %s\n",
+			region_dir, strerror(errno));
+		pool_free(pool, free_scan_job);
+		free(region_dir);
+		chunk_index_free(index);
+		return NULL;
+	}
+	free(region_dir);
+	/* the scans are quick, so waiting for them isn't worth more than a
+	 * sleep */
+	bool complete = true;
+	while (left > 0) {
+		struct scan_job *job = pool_take_done(pool);
+		if (job == NULL) {
+			nanosleep(&(struct timespec){ .tv_nsec = 1000000 },
+				  NULL);
+			continue;
+		}
+		--left;
+		char *key;
+		if (job->entry != NULL
+		    && (key = region_key(job->r_x, job->r_z)) != NULL) {
+			hashmap_add(index->regions, key, job->entry);
+			job->entry = NULL;
+		} else {
+			/* leaving a region out would say it's empty */
+			complete = false;
+		}
+		free_scan_job(job);
+	}
+	pool_free(pool, free_scan_job);
+	if (!complete) {
+		chunk_index_free(index);
+		return NULL;
+	}
+	return index;
+}
+
+void chunk_index_free(struct chunk_index *index)
+{
+	hashmap_free(index->regions, true, free);
+	free(index);
+}
+
+static struct region_entry *region_entry(struct chunk_index *index, int r_x,
+					 int r_z)
+{
+	char *key = region_key(r_x, r_z);
+	if (key == NULL)
+		return NULL;
+	struct region_entry *entry = hashmap_get(index->regions, key);
+	free(key);
+	return entry;
+}
+
+bool chunk_index_has(struct chunk_index *index, int c_x, int c_z)
+{
+	struct region_entry *entry = region_entry(
+	    index, mc_chunk_to_region(c_x), mc_chunk_to_region(c_z));
+	return entry != NULL
+	       && (entry->unknown
+		   || entry->present[c_z & 31] & (1u << (c_x & 31)));
+}
+
+int chunk_index_sectors(struct chunk_index *index, int c_x, int c_z)
+{
+	struct region_entry *entry = region_entry(
+	    index, mc_chunk_to_region(c_x), mc_chunk_to_region(c_z));
+	return entry == NULL ? 0 : entry->sectors[(c_x & 31) + (c_z & 31) * 32];
+}
+
+int chunk_index_region_len(struct chunk_index *index, int r_x, int r_z)
+{
+	struct region_entry *entry = region_entry(index, r_x, r_z);
+	if (entry == NULL)
+		return 0;
+	return entry->unknown ? -1 : entry->len;
+}
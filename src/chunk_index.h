@@ -0,0 +1,37 @@
+/* Which chunks are saved in the world, and how big they are, without reading
+ * any of them. It's built once from every region file's header, which is
+ * just the first 4KiB of the file, so questions like "is there anything
+ * here" or "how much would loading this read" don't have to touch the disk.
+ *
+ * Nothing updates it after it's built, so it only knows about chunks that
+ * were saved before then. Once it's built it's read-only, and safe to use
+ * from any thread. */
+#ifndef CHOWDER_CHUNK_INDEX_H
+#define CHOWDER_CHUNK_INDEX_H
+
+#include <stdbool.h>
+
+struct chunk_index;
+
+/* reads the header of every region file in world_path's region directory,
+ * using the given number of threads. returns NULL if the directory couldn't
+ * be read, which isn't the same as it not being there: a world without one
+ * just has no chunks */
+struct chunk_index *chunk_index_new(const char *world_path, int threads);
+void chunk_index_free(struct chunk_index *);
+
+/* A region file whose header couldn't be read is unknown rather than empty:
+ * chunk_index_has() says every chunk in it might be there, and it has to be
+ * read like there's no index at all. */
+
+/* these take global chunk coordinates */
+bool chunk_index_has(struct chunk_index *, int c_x, int c_z);
+/* returns how many 4KiB sectors the chunk takes up in its region file, or 0
+ * if it isn't there or its region is unknown */
+int chunk_index_sectors(struct chunk_index *, int c_x, int c_z);
+
+/* returns how many chunks are saved in a region, or -1 if it's unknown. takes
+ * region coordinates */
+int chunk_index_region_len(struct chunk_index *, int r_x, int r_z);
+
+#endif // CHOWDER_CHUNK_INDEX_H
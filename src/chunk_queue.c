@@ -0,0 +1,78 @@
+#include "chunk_queue.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int chunk_queue_push(struct chunk_queue *q, int c_x, int c_z)
+{
+	if (q->len == q->cap) {
+		size_t cap = q->cap == 0 ? 64 : q->cap * 2;
+		struct queued_chunk *chunks =
+		    reallocarray(q->chunks, cap, sizeof(struct queued_chunk));
+		if (chunks == NULL) {
+			perror("reallocarray");
+			return -1;
+		}
+		q->chunks = chunks;
+		q->cap = cap;
+	}
+	q->chunks[q->len++] = (struct queued_chunk){ .pos = { c_x, c_z } };
+	q->sorted = false;
+	return 0;
+}
+
+/* chunks go out in square rings around the player, and within a ring the
+ * ones nearest the middle of each side go first */
+static int distance(struct chunk_pos c, int center_x, int center_z)
+{
+	int dx = abs(c.x - center_x);
+	int dz = abs(c.z - center_z);
+	int ring = dx > dz ? dx : dz;
+	return ring * 4096 + dx * dx + dz * dz;
+}
+
+static int furthest_first(const void *p1, const void *p2)
+{
+	const struct queued_chunk *c1 = p1;
+	const struct queued_chunk *c2 = p2;
+	return c2->distance - c1->distance;
+}
+
+bool chunk_queue_pop(struct chunk_queue *q, int c_x, int c_z,
+		     struct chunk_pos *out)
+{
+	if (q->len == 0)
+		return false;
+	/* only sorted again when the player's moved into another chunk or
+	 * more chunks got queued, which isn't every tick */
+	if (!q->sorted || q->center_x != c_x || q->center_z != c_z) {
+		for (size_t i = 0; i < q->len; ++i)
+			q->chunks[i].distance =
+			    distance(q->chunks[i].pos, c_x, c_z);
+		qsort(q->chunks, q->len, sizeof(struct queued_chunk),
+		      furthest_first);
+		q->center_x = c_x;
+		q->center_z = c_z;
+		q->sorted = true;
+	}
+	*out = q->chunks[--q->len].pos;
+	return true;
+}
+
+void chunk_queue_retain(struct chunk_queue *q, struct view view)
+{
+	size_t kept = 0;
+	for (size_t i = 0; i < q->len; ++i) {
+		struct chunk_pos c = q->chunks[i].pos;
+		if (VIEW_CONTAINS(view, c.x, c.z))
+			q->chunks[kept++] = q->chunks[i];
+	}
+	/* the order of what's left doesn't change */
+	q->len = kept;
+}
+
+void chunk_queue_free(struct chunk_queue *q)
+{
+	free(q->chunks);
+	*q = (struct chunk_queue){ 0 };
+}
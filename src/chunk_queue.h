@@ -0,0 +1,46 @@
+/* The chunks a connection still has to be sent, nearest first. Chunks are
+ * queued when they come into view instead of being sent right away, so a join
+ * or a teleport doesn't write hundreds of chunks in one tick, and the ones
+ * around the player show up before the ones at the edge of the view. */
+#ifndef CHOWDER_CHUNK_QUEUE_H
+#define CHOWDER_CHUNK_QUEUE_H
+
+#include "view.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct chunk_pos {
+	int x;
+	int z;
+};
+
+struct queued_chunk {
+	struct chunk_pos pos;
+	/* from the center the queue was last sorted around */
+	int distance;
+};
+
+struct chunk_queue {
+	/* sorted furthest first, so the nearest one can be popped off the
+	 * end */
+	struct queued_chunk *chunks;
+	size_t len;
+	size_t cap;
+	/* the chunk the queue was sorted around */
+	int center_x;
+	int center_z;
+	bool sorted;
+};
+
+/* returns -1 if there wasn't room for it */
+int chunk_queue_push(struct chunk_queue *, int c_x, int c_z);
+/* takes the queued chunk nearest to center_x,center_z. returns false if the
+ * queue's empty */
+bool chunk_queue_pop(struct chunk_queue *, int center_x, int center_z,
+		     struct chunk_pos *out);
+/* drops every queued chunk that's outside the view */
+void chunk_queue_retain(struct chunk_queue *, struct view);
+void chunk_queue_free(struct chunk_queue *);
+
+#endif // CHOWDER_CHUNK_QUEUE_H
@@ -1,9 +1,11 @@
 #include "conn.h"
 
+#include "config.h"
 #include "mc.h"
 #include "message.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/socket.h>
 
 int cipher_init(EVP_CIPHER_CTX **ctx, const uint8_t secret[16], int enc)
@@ -20,7 +22,7 @@ int conn_init(struct conn *c, int sfd, const uint8_t secret[16])
 		return -1;
 	if (!cipher_init(&(c->_encrypt_ctx), secret, 1))
 		return -1;
-	c->messages_out = list_new();
+	queue_init(&c->messages_out);
 	return 0;
 }
 
@@ -31,10 +33,15 @@ void conn_finish(struct conn *c)
 	EVP_CIPHER_CTX_free(c->_encrypt_ctx);
 	if (c->player != NULL)
 		player_free(c->player);
-	while (!list_empty(c->messages_out)) {
-		message_free(list_remove(c->messages_out));
-	}
-	list_free(c->messages_out);
+	struct queue_node *node;
+	while ((node = queue_pop(&c->messages_out)) != NULL)
+		message_free(QUEUE_ITEM(node, struct message, node));
+	chunk_queue_free(&c->chunk_queue);
+	free(c->tracking);
+	timer_cancel(&c->keep_alive_timer);
+	timer_cancel(&c->timeout_timer);
+	timer_cancel(&c->join_timer);
+	timer_cancel(&c->idle_timer);
 }
 
 bool read_encrypted_byte(void *src, uint8_t *b)
@@ -68,14 +75,32 @@ int parse_encrypted_packet(struct conn *c)
 		return packet_len_bytes;
 	}
 
-	uint8_t in[p->packet_len];
+	/* the length comes straight from the client, so it can't be trusted
+	 * with the stack or the buffer */
+	if (p->packet_len <= 0 || p->packet_len > MAX_PACKET_LEN)
+		return PACKET_TOO_BIG;
+	if ((size_t) p->packet_len > p->data_len) {
+		size_t data_len = p->data_len;
+		while ((size_t) p->packet_len > data_len)
+			data_len += PACKET_BLOCK_SIZE;
+		void *buf = realloc(p->data, data_len);
+		if (buf == NULL)
+			return PACKET_REALLOC_FAILED;
+		p->data = buf;
+		p->data_len = data_len;
+	}
+	uint8_t *in = malloc(p->packet_len);
+	if (in == NULL)
+		return PACKET_REALLOC_FAILED;
 	if (read(c->sfd, in, p->packet_len) < 0) {
 		perror("read");
+		free(in);
 		return -1;
 	}
-	int outl = MAX_PACKET_LEN;
+	int outl = p->data_len;
 	int result = EVP_CipherUpdate(c->_decrypt_ctx, p->data, &outl, in,
 				      p->packet_len);
+	free(in);
 	if (result == 0) {
 		/* TODO: report openssl errors here and in
 		 * write_encrypted_packet */
@@ -92,15 +117,8 @@ int parse_encrypted_packet(struct conn *c)
 	return p->packet_len;
 }
 
-ssize_t write_encrypted_packet(struct conn *c)
+static ssize_t write_encrypted_packet(struct conn *c, const struct packet *p)
 {
-	struct packet *p = finalize_packet(c->packet);
-	if (p == NULL) {
-		fprintf(stderr,
-			"couldn't fit the finalized packet in it's buffer\n");
-		return -1;
-	}
-
 	int out_len =
 	    p->packet_len + EVP_CIPHER_CTX_block_size(c->_encrypt_ctx);
 	uint8_t out[out_len];
@@ -122,22 +140,48 @@ int conn_packet_read_header(struct conn *c)
 
 ssize_t conn_write_packet(struct conn *c)
 {
+	struct packet *p = finalize_packet(c->packet);
+	if (p == NULL) {
+		fprintf(stderr,
+			"couldn't fit the finalized packet in it's buffer\n");
+		return -1;
+	}
+	return conn_write_finalized(c, p);
+}
+
+ssize_t conn_write_finalized(struct conn *c, const struct packet *p)
+{
+	ssize_t written;
 	if (c->_encrypt_ctx != NULL)
-		return write_encrypted_packet(c);
-	return write_packet(c->sfd, finalize_packet(c->packet));
+		written = write_encrypted_packet(c, p);
+	else
+		written = write_packet(c->sfd, p);
+	if (written > 0)
+		c->bytes_out += written;
+	return written;
 }
 
-void conn_update_view_position_if_needed(struct conn *c, double new_x,
+void conn_update_view_position_if_needed(struct conn *c, int old_chunk_x,
+					 int old_chunk_z, double new_x,
 					 double new_z)
 {
-	int old_chunk_x = mc_coord_to_chunk(c->player->x);
-	int old_chunk_z = mc_coord_to_chunk(c->player->z);
 	int new_chunk_x = mc_coord_to_chunk(new_x);
 	int new_chunk_z = mc_coord_to_chunk(new_z);
 
-	if (old_chunk_x != new_chunk_x || old_chunk_z != new_chunk_z) {
+	/* old_chunk is where the view was last updated, so it's only set by
+	 * the first border crossing before the next update */
+	if ((old_chunk_x != new_chunk_x || old_chunk_z != new_chunk_z)
+	    && !c->requesting_chunks) {
 		c->requesting_chunks = true;
 		c->old_chunk_x = old_chunk_x;
 		c->old_chunk_z = old_chunk_z;
 	}
 }
+
+void conn_set_client_view_distance(struct conn *c, int view_distance)
+{
+	int max = server_properties.view_distance;
+	if (view_distance < 1)
+		view_distance = 1;
+	c->max_view_distance = view_distance < max ? view_distance : max;
+}
@@ -1,9 +1,12 @@
 #ifndef CHOWDER_CONN
 #define CHOWDER_CONN
 
+#include "chunk_queue.h"
 #include "message.h"
 #include "packet.h"
 #include "player.h"
+#include "queue.h"
+#include "timer_wheel.h"
 
 #include <stdint.h>
 #include <time.h>
@@ -17,23 +20,75 @@ struct conn {
 	EVP_CIPHER_CTX *_encrypt_ctx;
 	struct player *player;
 
+	/* what the client asked for, capped at the server's view distance */
+	uint8_t max_view_distance;
+	/* what it's actually getting, which can be less than the max when the
+	 * server's struggling */
 	uint8_t view_distance;
 	int32_t teleport_id;
 	int64_t keep_alive_id;
-	time_t last_ping;
-	time_t last_pong;
-	struct list *messages_out;
+	/* see server.c for what they're for, conn_finish() cancels them */
+	struct timer keep_alive_timer;
+	struct timer timeout_timer;
+	struct timer join_timer;
+	struct timer idle_timer;
+	/* set by a timer that wants the client gone, it's kicked with this
+	 * reason the next time server_play() gets to it */
+	const char *kick_reason;
+	/* struct messages, see message.h */
+	struct queue messages_out;
 	bool requesting_chunks; /* true after crossing a chunk border */
 	int old_chunk_x;
 	int old_chunk_z;
+
+	/* chunks in view that haven't been sent yet, they're sent a few at a
+	 * time by server_send_chunks() */
+	struct chunk_queue chunk_queue;
+	/* everything written to sfd so far, and how much of it was still
+	 * sitting in the socket at the end of the last tick. the difference
+	 * says how fast the client is actually taking data */
+	uint64_t bytes_out;
+	uint64_t last_bytes_out;
+	size_t last_unsent;
+	/* bytes per tick leaving the socket, averaged over the last few
+	 * ticks */
+	size_t drain_rate;
+
+	/* token buckets for how much the client's allowed to send, topped up
+	 * by how long it's been since they last were, see server_play() */
+	double packet_tokens;
+	double byte_tokens;
+	struct timespec tokens_refilled;
+	/* ticks in a row the client's run out of tokens with more waiting */
+	int throttled_ticks;
+	/* everything read from the client so far */
+	uint64_t packets_in;
+	uint64_t bytes_in;
+
+	/* the chunk it's filed under in the interest grid, see interest.h */
+	bool in_grid;
+	int cell_x;
+	int cell_z;
+	/* entity ids of the other players the client's been sent, sorted, so
+	 * it can be told when they go out of range */
+	int32_t *tracking;
+	int tracking_len;
+	int tracking_cap;
 };
 
 int conn_init(struct conn *, int, const uint8_t[16]);
 void conn_finish(struct conn *);
 int conn_packet_read_header(struct conn *);
 ssize_t conn_write_packet(struct conn *);
+/* writes a packet that's already been finalized, which doesn't have to be
+ * the connection's own. the same packet can be written to any number of
+ * connections, it only gets encrypted for each of them */
+ssize_t conn_write_finalized(struct conn *, const struct packet *);
 
-void conn_update_view_position_if_needed(struct conn *, double new_x,
+/* takes the chunk the player was in before moving, and its new position */
+void conn_update_view_position_if_needed(struct conn *, int old_chunk_x,
+					 int old_chunk_z, double new_x,
 					 double new_z);
+void conn_set_client_view_distance(struct conn *, int view_distance);
 
 #endif
@@ -0,0 +1,172 @@
+#include "entities.h"
+
+#include "mc.h"
+
+#include <stdlib.h>
+
+/* anything further than this in one move is a teleport, which says nothing
+ * about where the entity's headed */
+#define TELEPORT_DISTANCE 16
+
+#define EACH_FIELD(DO)                                                         \
+	DO(ids);                                                               \
+	DO(x);                                                                 \
+	DO(y);                                                                 \
+	DO(z);                                                                 \
+	DO(vel_x);                                                             \
+	DO(vel_z);                                                             \
+	DO(yaw);                                                               \
+	DO(pitch);                                                             \
+	DO(c_x);                                                               \
+	DO(c_z);                                                               \
+	DO(flags);                                                             \
+	DO(sent_x);                                                            \
+	DO(sent_y);                                                            \
+	DO(sent_z);                                                            \
+	DO(sent_yaw);                                                          \
+	DO(sent_pitch);                                                        \
+	DO(conns);                                                             \
+	DO(handles)
+
+struct entities *entities_new()
+{
+	struct entities *e = calloc(1, sizeof(struct entities));
+	if (e == NULL)
+		return NULL;
+	e->free_slot = -1;
+	e->next_id = 1;
+	return e;
+}
+
+void entities_free(struct entities *e)
+{
+#define FREE_FIELD(field) free(e->field)
+	EACH_FIELD(FREE_FIELD);
+#undef FREE_FIELD
+	free(e->slots);
+	free(e);
+}
+
+/* some of the arrays might have grown when it fails, but cap only changes
+ * once they all have */
+static bool grow(struct entities *e)
+{
+	int new_cap = e->cap == 0 ? 16 : e->cap * 2;
+#define GROW_FIELD(field)                                                      \
+	do {                                                                   \
+		void *new_field =                                              \
+		    realloc(e->field, new_cap * sizeof(*e->field));            \
+		if (new_field == NULL)                                         \
+			return false;                                          \
+		e->field = new_field;                                          \
+	} while (0)
+	EACH_FIELD(GROW_FIELD);
+#undef GROW_FIELD
+	e->cap = new_cap;
+	return true;
+}
+
+/* returns a handle that isn't in use, or -1 */
+static int take_slot(struct entities *e)
+{
+	if (e->free_slot < 0) {
+		int new_cap = e->slots_cap == 0 ? 16 : e->slots_cap * 2;
+		int *new_slots = realloc(e->slots, new_cap * sizeof(int));
+		if (new_slots == NULL)
+			return -1;
+		/* chain the new handles onto the free list */
+		for (int i = e->slots_cap; i < new_cap; ++i)
+			new_slots[i] = i + 1 < new_cap ? i + 1 : -1;
+		e->slots = new_slots;
+		e->free_slot = e->slots_cap;
+		e->slots_cap = new_cap;
+	}
+	int handle = e->free_slot;
+	e->free_slot = e->slots[handle];
+	return handle;
+}
+
+int entities_add(struct entities *e, struct conn *conn, double x, double y,
+		 double z)
+{
+	if (e->len == e->cap && !grow(e))
+		return -1;
+	int handle = take_slot(e);
+	if (handle < 0)
+		return -1;
+	int i = e->len++;
+	e->slots[handle] = i;
+	e->handles[i] = handle;
+	e->ids[i] = e->next_id++;
+	e->x[i] = x;
+	e->y[i] = y;
+	e->z[i] = z;
+	e->vel_x[i] = 0;
+	e->vel_z[i] = 0;
+	e->yaw[i] = 0;
+	e->pitch[i] = 0;
+	e->c_x[i] = mc_coord_to_chunk(x);
+	e->c_z[i] = mc_coord_to_chunk(z);
+	e->flags[i] = 0;
+	e->sent_x[i] = 0;
+	e->sent_y[i] = 0;
+	e->sent_z[i] = 0;
+	e->sent_yaw[i] = 0;
+	e->sent_pitch[i] = 0;
+	e->conns[i] = conn;
+	return handle;
+}
+
+void entities_remove(struct entities *e, int handle)
+{
+	if (handle < 0)
+		return;
+	/* the last one's moved into the gap, so nothing else moves */
+	int i = ENTITY_INDEX(e, handle);
+	int last = --e->len;
+	if (i != last) {
+#define MOVE_FIELD(field) e->field[i] = e->field[last]
+		EACH_FIELD(MOVE_FIELD);
+#undef MOVE_FIELD
+		e->slots[e->handles[i]] = i;
+	}
+	e->slots[handle] = e->free_slot;
+	e->free_slot = handle;
+}
+
+void entities_move(struct entities *e, int handle, double x, double y,
+		   double z, bool on_ground)
+{
+	int i = ENTITY_INDEX(e, handle);
+	double dx = x - e->x[i];
+	double dz = z - e->z[i];
+	if (dx * dx + dz * dz > TELEPORT_DISTANCE * TELEPORT_DISTANCE) {
+		e->vel_x[i] = 0;
+		e->vel_z[i] = 0;
+	} else {
+		e->vel_x[i] = (e->vel_x[i] * 3 + dx) / 4;
+		e->vel_z[i] = (e->vel_z[i] * 3 + dz) / 4;
+		e->flags[i] |= ENTITY_MOVED;
+	}
+	e->x[i] = x;
+	e->y[i] = y;
+	e->z[i] = z;
+	e->c_x[i] = mc_coord_to_chunk(x);
+	e->c_z[i] = mc_coord_to_chunk(z);
+	if (on_ground)
+		e->flags[i] |= ENTITY_ON_GROUND;
+	else
+		e->flags[i] &= ~ENTITY_ON_GROUND;
+}
+
+void entities_rotate(struct entities *e, int handle, float yaw, float pitch,
+		     bool on_ground)
+{
+	int i = ENTITY_INDEX(e, handle);
+	e->yaw[i] = yaw;
+	e->pitch[i] = pitch;
+	if (on_ground)
+		e->flags[i] |= ENTITY_ON_GROUND;
+	else
+		e->flags[i] &= ~ENTITY_ON_GROUND;
+}
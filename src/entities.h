@@ -0,0 +1,79 @@
+/* Everything that moves around the world, kept as a structure of arrays so
+ * the passes that run over all of them every tick (replicating movement,
+ * prefetching, working out who can see who) go through memory in order
+ * instead of chasing a pointer per player.
+ *
+ * An entity's index into the arrays changes when something before it is
+ * removed, so anything that holds onto one keeps a handle instead, which
+ * doesn't. ENTITY_INDEX() turns a handle into an index, which stays valid
+ * until the next entities_remove(). */
+#ifndef CHOWDER_ENTITIES_H
+#define CHOWDER_ENTITIES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct conn;
+
+#define ENTITY_ON_GROUND (1 << 0)
+/* a position update came in since server_prefetch_chunks() last ran */
+#define ENTITY_MOVED (1 << 1)
+
+struct entities {
+	int len;
+	int cap;
+
+	int32_t *ids;
+	double *x;
+	double *y;
+	double *z;
+	/* blocks per tick, averaged over the last few moves */
+	double *vel_x;
+	double *vel_z;
+	float *yaw;
+	float *pitch;
+	/* the chunk x,z is in */
+	int *c_x;
+	int *c_z;
+	uint8_t *flags;
+	/* where everyone that can see the entity was last told it is, in
+	 * 1/4096ths of a block like relative moves are, and the angles it was
+	 * facing. see server_replicate_players() */
+	int64_t *sent_x;
+	int64_t *sent_y;
+	int64_t *sent_z;
+	uint8_t *sent_yaw;
+	uint8_t *sent_pitch;
+	/* the connection controlling it */
+	struct conn **conns;
+
+	/* handle of the entity at each index */
+	int *handles;
+	/* index of the entity with each handle, or the next free handle for
+	 * ones that aren't in use */
+	int *slots;
+	int slots_cap;
+	int free_slot;
+	int32_t next_id;
+};
+
+#define ENTITY_INDEX(entities, handle) ((entities)->slots[handle])
+
+struct entities *entities_new();
+void entities_free(struct entities *);
+
+/* returns the new entity's handle, or -1 if there's no memory. it gets an
+ * entity id nothing else has had */
+int entities_add(struct entities *, struct conn *, double x, double y,
+		 double z);
+/* does nothing with a handle of -1 */
+void entities_remove(struct entities *, int handle);
+
+/* updates the entity's position, chunk and velocity, and marks it as moved.
+ * a move far enough to be a teleport resets its velocity */
+void entities_move(struct entities *, int handle, double x, double y,
+		   double z, bool on_ground);
+void entities_rotate(struct entities *, int handle, float yaw, float pitch,
+		     bool on_ground);
+
+#endif // CHOWDER_ENTITIES_H
@@ -0,0 +1,161 @@
+#include "interest.h"
+
+#include "hashmap.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* long enough for "-2147483648,-2147483648" */
+#define CELL_KEY_LEN 24
+
+struct cell {
+	int x;
+	int z;
+	struct conn **conns;
+	int len;
+	int cap;
+};
+
+struct interest_grid {
+	/* cells keyed by "x,z", only the ones with someone in them */
+	struct hashmap *cells;
+};
+
+struct nearby_ctx {
+	int c_x;
+	int c_z;
+	int range;
+	interest_func func;
+	void *data;
+};
+
+static void cell_key(char *key, int x, int z)
+{
+	snprintf(key, CELL_KEY_LEN, "%d,%d", x, z);
+}
+
+static void free_cell(void *data)
+{
+	struct cell *cell = data;
+	free(cell->conns);
+	free(cell);
+}
+
+struct interest_grid *interest_grid_new()
+{
+	struct interest_grid *grid = malloc(sizeof(struct interest_grid));
+	if (grid == NULL)
+		return NULL;
+	grid->cells = hashmap_new(16);
+	return grid;
+}
+
+void interest_grid_free(struct interest_grid *grid)
+{
+	hashmap_free(grid->cells, true, free_cell);
+	free(grid);
+}
+
+static void cell_add(struct interest_grid *grid, struct conn *conn, int x,
+		     int z)
+{
+	char key[CELL_KEY_LEN];
+	cell_key(key, x, z);
+	struct cell *cell = hashmap_get(grid->cells, key);
+	if (cell == NULL) {
+		cell = calloc(1, sizeof(struct cell));
+		if (cell == NULL)
+			return;
+		cell->x = x;
+		cell->z = z;
+		hashmap_add(grid->cells, strdup(key), cell);
+	}
+	if (cell->len == cell->cap) {
+		int new_cap = cell->cap == 0 ? 4 : cell->cap * 2;
+		struct conn **new_conns =
+		    realloc(cell->conns, new_cap * sizeof(struct conn *));
+		if (new_conns == NULL)
+			return;
+		cell->conns = new_conns;
+		cell->cap = new_cap;
+	}
+	cell->conns[cell->len++] = conn;
+	conn->in_grid = true;
+	conn->cell_x = x;
+	conn->cell_z = z;
+}
+
+void interest_grid_remove(struct interest_grid *grid, struct conn *conn)
+{
+	if (!conn->in_grid)
+		return;
+	conn->in_grid = false;
+	char key[CELL_KEY_LEN];
+	cell_key(key, conn->cell_x, conn->cell_z);
+	struct cell *cell = hashmap_get(grid->cells, key);
+	if (cell == NULL)
+		return;
+	for (int i = 0; i < cell->len; ++i) {
+		if (cell->conns[i] == conn) {
+			cell->conns[i] = cell->conns[--cell->len];
+			break;
+		}
+	}
+	if (cell->len == 0)
+		free_cell(hashmap_remove(grid->cells, key));
+}
+
+void interest_grid_update(struct interest_grid *grid, struct conn *conn,
+			  int x, int z)
+{
+	if (conn->in_grid && conn->cell_x == x && conn->cell_z == z)
+		return;
+	interest_grid_remove(grid, conn);
+	cell_add(grid, conn, x, z);
+}
+
+static void visit_cell(struct cell *cell, struct nearby_ctx *ctx)
+{
+	for (int i = 0; i < cell->len; ++i)
+		ctx->func(cell->conns[i], ctx->data);
+}
+
+static void visit_if_nearby(char *key, void *value, void *data)
+{
+	(void) key;
+
+	struct cell *cell = value;
+	struct nearby_ctx *ctx = data;
+	if (abs(cell->x - ctx->c_x) <= ctx->range
+	    && abs(cell->z - ctx->c_z) <= ctx->range)
+		visit_cell(cell, ctx);
+}
+
+void interest_grid_nearby(struct interest_grid *grid, int c_x, int c_z,
+			  int range, interest_func func, void *data)
+{
+	struct nearby_ctx ctx = {
+		.c_x = c_x,
+		.c_z = c_z,
+		.range = range,
+		.func = func,
+		.data = data,
+	};
+	/* with players spread out, there are fewer cells to check than chunks
+	 * in range */
+	size_t area = (size_t) (range * 2 + 1) * (range * 2 + 1);
+	if (hashmap_occupied(grid->cells) < area) {
+		hashmap_apply(grid->cells, visit_if_nearby, &ctx);
+		return;
+	}
+	char key[CELL_KEY_LEN];
+	for (int z = c_z - range; z <= c_z + range; ++z) {
+		for (int x = c_x - range; x <= c_x + range; ++x) {
+			cell_key(key, x, z);
+			struct cell *cell = hashmap_get(grid->cells, key);
+			if (cell != NULL)
+				visit_cell(cell, &ctx);
+		}
+	}
+}
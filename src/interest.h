@@ -0,0 +1,34 @@
+/* Which connections are where, a chunk at a time, so anything that only
+ * matters to players nearby (movement, block changes and so on) can go to
+ * just them instead of everyone on the server. Finding who's near something
+ * costs about as much as there are players around it, not as much as there
+ * are players.
+ *
+ * Connections go in with interest_grid_update() once their player has a
+ * position, and have to be updated whenever it changes. */
+#ifndef CHOWDER_INTEREST_H
+#define CHOWDER_INTEREST_H
+
+#include "conn.h"
+
+struct interest_grid;
+
+typedef void (*interest_func)(struct conn *, void *data);
+
+struct interest_grid *interest_grid_new();
+void interest_grid_free(struct interest_grid *);
+
+/* puts the connection in the cell for the chunk its player is in, moving it
+ * out of the one it was in before. this is cheap when it hasn't left the
+ * chunk, so it's fine to call on every position update */
+void interest_grid_update(struct interest_grid *, struct conn *, int c_x,
+			  int c_z);
+/* does nothing if the connection isn't in the grid */
+void interest_grid_remove(struct interest_grid *, struct conn *);
+
+/* calls func for every connection with its player in the square of chunks
+ * range chunks out from c_x,c_z, the same shape as a view */
+void interest_grid_nearby(struct interest_grid *, int c_x, int c_z, int range,
+			  interest_func func, void *data);
+
+#endif // CHOWDER_INTEREST_H
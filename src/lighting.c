@@ -0,0 +1,340 @@
+#include "lighting.h"
+
+#include "blocks.h"
+#include "light.h"
+#include "mc.h"
+#include "world.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+enum light_type {
+	LIGHT_SKY,
+	LIGHT_BLOCK,
+	LIGHT_TYPES_LEN,
+};
+
+struct light_node {
+	int32_t x;
+	int32_t z;
+	int16_t y;
+	/* the light that used to be here, only used for removal */
+	uint8_t level;
+};
+
+struct light_queue {
+	struct light_node *nodes;
+	size_t head;
+	size_t len;
+	size_t cap;
+};
+
+/* which sections of a chunk have been written to, and so have their own
+ * writable light until the next lighting_flush() */
+struct light_dirty {
+	int c_x;
+	int c_z;
+	uint32_t masks[LIGHT_TYPES_LEN];
+};
+
+struct lighting {
+	struct light_queue removals[LIGHT_TYPES_LEN];
+	struct light_queue additions[LIGHT_TYPES_LEN];
+
+	struct light_dirty *dirty;
+	size_t dirty_len;
+	size_t dirty_cap;
+
+	/* nearly every lookup is for the same chunk as the last one, and
+	 * world_chunk_at() isn't cheap. only valid inside one call, since
+	 * chunks can get unloaded between them */
+	struct chunk *cached;
+	int cached_x;
+	int cached_z;
+};
+
+static const int dirs[6][3] = {
+	{ 0, -1, 0 }, { 0, 1, 0 },  { -1, 0, 0 },
+	{ 1, 0, 0 },  { 0, 0, -1 }, { 0, 0, 1 },
+};
+#define DIR_DOWN 0
+
+struct lighting *lighting_new()
+{
+	return calloc(1, sizeof(struct lighting));
+}
+
+void lighting_free(struct lighting *l)
+{
+	for (int t = 0; t < LIGHT_TYPES_LEN; ++t) {
+		free(l->removals[t].nodes);
+		free(l->additions[t].nodes);
+	}
+	free(l->dirty);
+	free(l);
+}
+
+static bool light_queue_empty(const struct light_queue *q)
+{
+	return q->head == q->len;
+}
+
+static void light_queue_push(struct light_queue *q, int x, int y, int z,
+			     int level)
+{
+	if (q->len == q->cap) {
+		/* reuse the space that's already been popped before growing */
+		if (q->head > 0) {
+			memmove(q->nodes, q->nodes + q->head,
+				(q->len - q->head) * sizeof(struct light_node));
+			q->len -= q->head;
+			q->head = 0;
+		}
+		if (q->len == q->cap) {
+			size_t cap = q->cap == 0 ? 256 : q->cap * 2;
+			struct light_node *nodes = reallocarray(
+			    q->nodes, cap, sizeof(struct light_node));
+			if (nodes == NULL) {
+				perror("reallocarray");
+				return;
+			}
+			q->nodes = nodes;
+			q->cap = cap;
+		}
+	}
+	q->nodes[q->len++] = (struct light_node){ x, z, y, level };
+}
+
+static struct light_node light_queue_pop(struct light_queue *q)
+{
+	struct light_node n = q->nodes[q->head++];
+	if (light_queue_empty(q))
+		q->head = q->len = 0;
+	return n;
+}
+
+static struct chunk *chunk_at(struct lighting *l, struct world *w, int x,
+			      int z)
+{
+	int c_x = mc_coord_to_chunk(x);
+	int c_z = mc_coord_to_chunk(z);
+	if (l->cached == NULL || l->cached_x != c_x || l->cached_z != c_z) {
+		l->cached = world_chunk_at(w, c_x, c_z);
+		l->cached_x = c_x;
+		l->cached_z = c_z;
+	}
+	return l->cached;
+}
+
+static struct light_dirty *dirty_at(struct lighting *l, int c_x, int c_z)
+{
+	for (size_t i = l->dirty_len; i-- > 0;)
+		if (l->dirty[i].c_x == c_x && l->dirty[i].c_z == c_z)
+			return &l->dirty[i];
+
+	if (l->dirty_len == l->dirty_cap) {
+		size_t cap = l->dirty_cap == 0 ? 16 : l->dirty_cap * 2;
+		struct light_dirty *dirty =
+		    reallocarray(l->dirty, cap, sizeof(struct light_dirty));
+		if (dirty == NULL) {
+			perror("reallocarray");
+			return NULL;
+		}
+		l->dirty = dirty;
+		l->dirty_cap = cap;
+	}
+	struct light_dirty *d = &l->dirty[l->dirty_len++];
+	*d = (struct light_dirty){ .c_x = c_x, .c_z = c_z };
+	return d;
+}
+
+static uint8_t **section_light(struct section *s, enum light_type t)
+{
+	return t == LIGHT_SKY ? &s->sky_light : &s->block_light;
+}
+
+/* Returns -1 where light can't go, which is unloaded chunks and below the
+ * bottom section. Above the top section there's nothing to block the sky, so
+ * that's always full sky light and no block light. */
+static int light_at(struct lighting *l, struct world *w, enum light_type t,
+		    int x, int y, int z)
+{
+	struct chunk *c = chunk_at(l, w, x, z);
+	int i = CHUNK_SECTION_INDEX(y >> 4);
+	if (c == NULL || i < 0)
+		return -1;
+	else if (i >= c->sections_len)
+		return t == LIGHT_SKY ? 15 : 0;
+
+	uint8_t *light = *section_light(&c->sections[i], t);
+	return light == NULL ? 0 : light_get(light, x & 15, y & 15, z & 15);
+}
+
+static void set_light_at(struct lighting *l, struct world *w,
+			 enum light_type t, int x, int y, int z, int level)
+{
+	struct chunk *c = chunk_at(l, w, x, z);
+	int i = CHUNK_SECTION_INDEX(y >> 4);
+	if (c == NULL || i < 0 || i >= c->sections_len)
+		return;
+
+	uint8_t **light = section_light(&c->sections[i], t);
+	struct light_dirty *d = dirty_at(l, l->cached_x, l->cached_z);
+	if (d == NULL)
+		return;
+	if (!(d->masks[t] & (1 << i))) {
+		uint8_t *writable = *light == NULL
+					? light_alloc(0)
+					: light_make_writable(*light);
+		if (writable == NULL)
+			return;
+		*light = writable;
+		d->masks[t] |= 1 << i;
+	}
+	light_set(*light, x & 15, y & 15, z & 15, level);
+}
+
+static int opacity_at(struct lighting *l, struct world *w, int x, int y, int z)
+{
+	struct chunk *c = chunk_at(l, w, x, z);
+	int block = c == NULL ? -1 : chunk_block_at(c, x, y, z);
+	return block < 0 ? 0 : block_light_opacity(block);
+}
+
+static int emission_at(struct lighting *l, struct world *w, int x, int y,
+		       int z)
+{
+	struct chunk *c = chunk_at(l, w, x, z);
+	int block = c == NULL ? -1 : chunk_block_at(c, x, y, z);
+	return block < 0 ? 0 : block_light_emission(block);
+}
+
+void lighting_block_changed(struct world *w, int x, int y, int z)
+{
+	struct lighting *l = world_lighting(w);
+	l->cached = NULL;
+	for (enum light_type t = 0; t < LIGHT_TYPES_LEN; ++t) {
+		/* take out whatever light was here, and anything that could
+		 * have come from it */
+		int old = light_at(l, w, t, x, y, z);
+		if (old < 0)
+			continue;
+		if (old > 0) {
+			set_light_at(l, w, t, x, y, z, 0);
+			light_queue_push(&l->removals[t], x, y, z, old);
+		}
+		int emission =
+		    t == LIGHT_BLOCK ? emission_at(l, w, x, y, z) : 0;
+		if (emission > 0) {
+			set_light_at(l, w, t, x, y, z, emission);
+			light_queue_push(&l->additions[t], x, y, z, emission);
+		}
+		/* and if the new block lets more light through, the light
+		 * around it has to spread back in */
+		for (int d = 0; d < 6; ++d) {
+			int nx = x + dirs[d][0];
+			int ny = y + dirs[d][1];
+			int nz = z + dirs[d][2];
+			if (light_at(l, w, t, nx, ny, nz) > 0)
+				light_queue_push(&l->additions[t], nx, ny, nz,
+						 0);
+		}
+	}
+}
+
+static void propagate_removal(struct lighting *l, struct world *w,
+			      enum light_type t, struct light_node n)
+{
+	for (int d = 0; d < 6; ++d) {
+		int x = n.x + dirs[d][0];
+		int y = n.y + dirs[d][1];
+		int z = n.z + dirs[d][2];
+		int level = light_at(l, w, t, x, y, z);
+		if (level <= 0)
+			continue;
+		/* a 15 under a 15 is sky light that came straight down */
+		bool from_sky = t == LIGHT_SKY && d == DIR_DOWN && n.level == 15
+				&& level == 15;
+		if (level < n.level || from_sky) {
+			set_light_at(l, w, t, x, y, z, 0);
+			light_queue_push(&l->removals[t], x, y, z, level);
+		} else {
+			/* lit by something else, which has to fill back in
+			 * where the old light was */
+			light_queue_push(&l->additions[t], x, y, z, 0);
+		}
+	}
+}
+
+static void propagate_addition(struct lighting *l, struct world *w,
+			       enum light_type t, struct light_node n)
+{
+	int level = light_at(l, w, t, n.x, n.y, n.z);
+	if (level <= 1)
+		return;
+	for (int d = 0; d < 6; ++d) {
+		int x = n.x + dirs[d][0];
+		int y = n.y + dirs[d][1];
+		int z = n.z + dirs[d][2];
+		int old = light_at(l, w, t, x, y, z);
+		if (old < 0 || old >= level)
+			continue;
+		int opacity = opacity_at(l, w, x, y, z);
+		int new = level - (opacity > 1 ? opacity : 1);
+		if (t == LIGHT_SKY && d == DIR_DOWN && level == 15
+		    && opacity == 0)
+			new = 15;
+		if (new > old) {
+			set_light_at(l, w, t, x, y, z, new);
+			light_queue_push(&l->additions[t], x, y, z, 0);
+		}
+	}
+}
+
+bool lighting_update(struct world *w, size_t max_nodes)
+{
+	struct lighting *l = world_lighting(w);
+	l->cached = NULL;
+	size_t n = 0;
+	for (enum light_type t = 0; t < LIGHT_TYPES_LEN; ++t) {
+		/* everything has to be removed before anything's added back,
+		 * or the old light would just spread back in */
+		struct light_queue *removals = &l->removals[t];
+		struct light_queue *additions = &l->additions[t];
+		while (!light_queue_empty(removals) && n++ < max_nodes)
+			propagate_removal(l, w, t, light_queue_pop(removals));
+		while (light_queue_empty(removals)
+		       && !light_queue_empty(additions) && n++ < max_nodes)
+			propagate_addition(l, w, t, light_queue_pop(additions));
+	}
+
+	for (enum light_type t = 0; t < LIGHT_TYPES_LEN; ++t)
+		if (!light_queue_empty(&l->removals[t])
+		    || !light_queue_empty(&l->additions[t]))
+			return false;
+	return true;
+}
+
+void lighting_flush(struct world *w, light_changed_func changed, void *data)
+{
+	struct lighting *l = world_lighting(w);
+	for (size_t i = 0; i < l->dirty_len; ++i) {
+		struct light_dirty *d = &l->dirty[i];
+		struct chunk *c = world_chunk_at(w, d->c_x, d->c_z);
+		if (c == NULL)
+			continue;
+		/* done writing for now, so sections that ended up with the
+		 * same light as others can go back to sharing it */
+		for (int s = 0; s < CHUNK_SECTIONS_LEN; ++s) {
+			for (enum light_type t = 0; t < LIGHT_TYPES_LEN; ++t) {
+				uint8_t **light =
+				    section_light(&c->sections[s], t);
+				if (d->masks[t] & (1 << s))
+					*light = light_share(*light);
+			}
+		}
+		changed(d->c_x, d->c_z, c, d->masks[LIGHT_SKY],
+			d->masks[LIGHT_BLOCK], data);
+	}
+	l->dirty_len = 0;
+}
@@ -0,0 +1,41 @@
+/* Light gets relit incrementally when blocks change, instead of being
+ * recomputed for the whole chunk. A changed block only queues work; it's
+ * propagated in lighting_update(), so many changes in the same area get relit
+ * in one pass, and a huge edit gets spread over as many ticks as it needs.
+ *
+ * Propagation is the usual two-queue flood fill: light that might have come
+ * from a changed block is removed first, then whatever's left around the
+ * removed area is spread back in. Sky light works the same way, except a 15
+ * keeps going straight down without losing any light. */
+#ifndef CHOWDER_LIGHTING_H
+#define CHOWDER_LIGHTING_H
+
+#include "chunk.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct world;
+struct lighting;
+
+struct lighting *lighting_new();
+void lighting_free(struct lighting *);
+
+/* queues relighting around a block that's just been changed. takes a global
+ * position */
+void lighting_block_changed(struct world *, int x, int y, int z);
+/* propagates at most max_nodes queued blocks' worth of light, returns true if
+ * there's nothing left queued */
+bool lighting_update(struct world *, size_t max_nodes);
+
+/* masks have a bit set for every section index whose light changed */
+typedef void (*light_changed_func)(int c_x, int c_z, struct chunk *,
+				   uint32_t sky_mask, uint32_t block_mask,
+				   void *data);
+/* calls changed() once for every chunk whose light changed since the last
+ * call. only call it once lighting_update() has returned true, or it'll pass
+ * on light that's still being relit */
+void lighting_flush(struct world *, light_changed_func changed, void *data);
+
+#endif // CHOWDER_LIGHTING_H
@@ -6,7 +6,10 @@
 #include "rsa.h"
 #include "server.h"
 #include "strutil.h"
+#include "tick.h"
+#include "watchdog.h"
 #include "world.h"
+#include "zpool.h"
 
 #include <arpa/inet.h>
 #include <assert.h>
@@ -19,7 +22,6 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
-#include <time.h>
 #include <unistd.h>
 
 #include <openssl/evp.h>
@@ -28,8 +30,6 @@
 #define LEVELS_DIR  "levels"
 #define BLOCKS_PATH "gamedata/blocks.json"
 
-#define TICK_LEN_NSEC 50000000
-
 static bool running = true;
 
 void sigint_handler(int);
@@ -88,19 +88,18 @@ int main()
 		world_free(w);
 		exit(EXIT_FAILURE);
 	}
-	struct list *connections = list_new();
+	/* struct conn *s */
+	struct vector connections;
+	vector_init(&connections, sizeof(struct conn *));
 	struct packet packet;
 	packet_init(&packet);
 
-	/* TODO: keep track of a "tick debt" so the server can catch up when a
-	 *       tick takes too long */
-	struct timespec tick_start_time;
-	struct timespec current_time;
+	struct tick_clock tc;
+	if (tick_clock_init(&tc) < 0 || watchdog_start() < 0)
+		exit(EXIT_FAILURE);
 	while (running) {
-		if (clock_gettime(CLOCK_MONOTONIC, &tick_start_time) < 0) {
-			perror("clock_gettime");
-			break;
-		}
+		tick_begin(&tc);
+		timer_wheel_advance(world_timers(w));
 
 		int conn = accept(sfd, NULL, NULL);
 		if (conn == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
@@ -113,63 +112,84 @@ int main()
 
 			struct conn *c =
 			    server_accept_connection(conn, &packet, w, &l_ctx);
-			if (c != NULL) {
-				list_append(connections, sizeof(struct conn *),
-					    &c);
+			if (c != NULL && vector_push(&connections, &c) < 0) {
+				fprintf(stderr, "no room for connection :(\n");
+				interest_grid_remove(world_interest(w), c);
+				entities_remove(world_entities(w),
+						c->player->entity);
+				conn_finish(c);
+				free(c);
 			}
 		}
 
-		struct list *connection = connections;
-		while (!list_empty(connection)) {
-			struct conn *c = list_item(connection);
+		for (size_t i = 0; i < connections.len;) {
+			struct conn *c =
+			    VECTOR_AT(&connections, struct conn *, i);
 			int status = server_play(c, w);
 			if (status <= 0) {
-				list_remove(connection);
+				/* the last one's moved into its place, so i
+				 * stays put */
+				vector_swap_remove(&connections, i);
+				interest_grid_remove(world_interest(w), c);
+				entities_remove(world_entities(w),
+						c->player->entity);
 				conn_finish(c);
 				free(c);
 			} else {
-				if (c->requesting_chunks) {
-					server_update_view(c, w);
-				}
-				connection = list_next(connection);
+				++i;
 			}
 		}
-		connection = connections;
+		tick_phase_end(&tc, TICK_NETWORK_IN);
+
+		for (size_t i = 0; i < connections.len; ++i) {
+			struct conn *c =
+			    VECTOR_AT(&connections, struct conn *, i);
+			if (c->requesting_chunks) {
+				server_update_view(c, w);
+			}
+		}
+		tick_phase_end(&tc, TICK_ACT);
+
+		server_send_generated(w);
+		server_prefetch_chunks(w);
+		server_update_light(w);
+		server_adjust_view_distances(&connections, w,
+					     tc.last_tick_nsec);
+		tick_phase_end(&tc, TICK_WORLD);
+
+		server_replicate_players(w);
 		struct protocol_do_err err = { 0 };
-		while (!list_empty(connection)
-		       && err.err_type == PROTOCOL_DO_ERR_SUCCESS) {
-			struct list *messages =
-			    ((struct conn *) list_item(connection))
-				->messages_out;
-			err = server_send_messages(connections, messages);
-			connection = list_next(connection);
+		for (size_t i = 0; i < connections.len
+				   && err.err_type == PROTOCOL_DO_ERR_SUCCESS;
+		     ++i) {
+			struct conn *c =
+			    VECTOR_AT(&connections, struct conn *, i);
+			err = server_send_messages(&connections, w,
+						   &c->messages_out);
 		}
 		if (err.err_type != PROTOCOL_DO_ERR_SUCCESS) {
 			fprintf(stderr, "error sending message or some shit\n");
 		}
+		tick_phase_end(&tc, TICK_BROADCAST);
 
-		if (clock_gettime(CLOCK_MONOTONIC, &current_time) < 0) {
-			perror("clock_gettime");
-			break;
-		} else if (current_time.tv_nsec - tick_start_time.tv_nsec
-			   < TICK_LEN_NSEC) {
-			struct timespec sleep_time = { 0 };
-			sleep_time.tv_nsec =
-			    TICK_LEN_NSEC
-			    - (current_time.tv_nsec - tick_start_time.tv_nsec);
-			/* TODO: handle interrupted sleep, probably */
-			clock_nanosleep(CLOCK_MONOTONIC, 0, &sleep_time, NULL);
-		}
+		server_send_chunks(&connections, w);
+		tick_phase_end(&tc, TICK_NETWORK_OUT);
+
+		server_report_traffic(&connections);
+		tick_end(&tc);
 	}
 
 	puts("shutdown time");
+	watchdog_stop();
 
+	vector_free(&connections);
 	free(packet.data);
 	free(der);
 	EVP_PKEY_CTX_free(ctx);
 	EVP_PKEY_free(pkey);
 	close(sfd);
 	world_free(w);
+	zpool_free();
 	free_server_properties();
 
 	exit(EXIT_SUCCESS);
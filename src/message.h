@@ -3,8 +3,11 @@
 
 #include "player.h"
 #include "protocol_types.h"
+#include "queue.h"
 
 struct message {
+	/* for the queue it's waiting in */
+	struct queue_node node;
 	struct player *from;
 	int packet_id;
 	void *packet_struct;
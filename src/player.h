@@ -7,9 +7,9 @@ struct player {
 	char username[17];
 	char *textures;
 
-	double x;
-	double y;
-	double z;
+	/* handle for its position and such in the world's entity store, see
+	 * entities.h */
+	int entity;
 };
 
 void player_free(struct player *);
@@ -0,0 +1,132 @@
+#include "pool.h"
+
+#include "queue.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+struct job {
+	job_func run;
+	void *data;
+	struct queue_node node;
+};
+
+struct pool {
+	pthread_mutex_t lock;
+	pthread_cond_t queued;
+	struct queue todo;
+	struct queue done;
+	bool stopping;
+
+	int threads_len;
+	pthread_t threads[];
+};
+
+static struct job *pop_job(struct queue *q)
+{
+	struct queue_node *node = queue_pop(q);
+	return node == NULL ? NULL : QUEUE_ITEM(node, struct job, node);
+}
+
+static void *worker(void *arg)
+{
+	struct pool *pool = arg;
+	pthread_mutex_lock(&pool->lock);
+	while (true) {
+		struct job *job;
+		while ((job = pop_job(&pool->todo)) == NULL
+		       && !pool->stopping)
+			pthread_cond_wait(&pool->queued, &pool->lock);
+		if (job == NULL)
+			break;
+		pthread_mutex_unlock(&pool->lock);
+		job->run(job->data);
+		pthread_mutex_lock(&pool->lock);
+		queue_push(&pool->done, &job->node);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+struct pool *pool_new(int threads)
+{
+	struct pool *pool =
+	    calloc(1, sizeof(struct pool) + threads * sizeof(pthread_t));
+	if (pool == NULL)
+		return NULL;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->queued, NULL);
+	for (; pool->threads_len < threads; ++pool->threads_len) {
+		if (pthread_create(&pool->threads[pool->threads_len], NULL,
+				   worker, pool)
+		    != 0) {
+			fprintf(stderr, "pool_new(): couldn't start thread\n");
+			pool_free(pool, NULL);
+			return NULL;
+		}
+	}
+	return pool;
+}
+
+int pool_submit(struct pool *pool, job_func run, void *data)
+{
+	struct job *job = malloc(sizeof(struct job));
+	if (job == NULL)
+		return -1;
+	job->run = run;
+	job->data = data;
+	pthread_mutex_lock(&pool->lock);
+	queue_push(&pool->todo, &job->node);
+	pthread_cond_signal(&pool->queued);
+	pthread_mutex_unlock(&pool->lock);
+	return 0;
+}
+
+void *pool_take_done(struct pool *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	struct job *job = pop_job(&pool->done);
+	pthread_mutex_unlock(&pool->lock);
+	if (job == NULL)
+		return NULL;
+	void *data = job->data;
+	free(job);
+	return data;
+}
+
+static void free_queue(struct queue *q, free_item_func free_data)
+{
+	struct job *job;
+	while ((job = pop_job(q)) != NULL) {
+		if (free_data != NULL)
+			free_data(job->data);
+		free(job);
+	}
+}
+
+void pool_free(struct pool *pool, free_item_func free_data)
+{
+	pthread_mutex_lock(&pool->lock);
+	pool->stopping = true;
+	/* nothing else gets run, the workers just finish what they're on */
+	free_queue(&pool->todo, free_data);
+	pthread_cond_broadcast(&pool->queued);
+	pthread_mutex_unlock(&pool->lock);
+	for (int i = 0; i < pool->threads_len; ++i)
+		pthread_join(pool->threads[i], NULL);
+
+	free_queue(&pool->done, free_data);
+	pthread_cond_destroy(&pool->queued);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+}
+
+int pool_default_threads()
+{
+	/* leave a core for the main thread */
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	return cores > 2 ? cores - 1 : 1;
+}
@@ -0,0 +1,28 @@
+/* A fixed set of worker threads running jobs off a queue, for work that
+ * shouldn't hold up a tick. A job's data is handed back through
+ * pool_take_done() once it's run, so whatever it produced can be picked up
+ * on the main thread. */
+#ifndef CHOWDER_POOL_H
+#define CHOWDER_POOL_H
+
+#include "hashmap.h"
+
+typedef void (*job_func)(void *data);
+
+struct pool;
+
+/* returns NULL if the threads couldn't be started */
+struct pool *pool_new(int threads);
+/* returns 0 on success, or -1 if the job couldn't be queued */
+int pool_submit(struct pool *, job_func run, void *data);
+/* returns the data of a job that's finished running, or NULL if none have.
+ * never blocks */
+void *pool_take_done(struct pool *);
+/* waits for running jobs to finish, and calls free_data on every job's data
+ * that hasn't been taken yet, run or not */
+void pool_free(struct pool *, free_item_func free_data);
+
+/* how many workers to use when there's no reason to pick anything else */
+int pool_default_threads();
+
+#endif // CHOWDER_POOL_H
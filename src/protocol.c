@@ -20,6 +20,38 @@ struct protocol_do_err protocol_do_write(protocol_write_func write_func,
 	return err;
 }
 
+struct protocol_do_err protocol_do_encode(protocol_write_func write_func,
+					  struct packet *p, void *packet_data)
+{
+	struct protocol_do_err err = { 0 };
+	struct protocol_err protocol_err = write_func(p, packet_data);
+	if (protocol_err.err_type != PROTOCOL_ERR_SUCCESS) {
+		err.err_type = PROTOCOL_DO_ERR_PROTOCOL;
+		err.protocol_err = protocol_err;
+		return err;
+	}
+	printf("INFO: encoded 0x%02x\n", p->packet_id);
+	if (finalize_packet(p) == NULL) {
+		fprintf(stderr,
+			"couldn't fit the finalized packet in it's buffer\n");
+		err.err_type = PROTOCOL_DO_ERR_WRITE;
+		err.write_err = -1;
+	}
+	return err;
+}
+
+struct protocol_do_err protocol_do_write_finalized(struct conn *conn,
+						   const struct packet *p)
+{
+	struct protocol_do_err err = { 0 };
+	ssize_t write_err = conn_write_finalized(conn, p);
+	if (write_err < 0) {
+		err.err_type = PROTOCOL_DO_ERR_WRITE;
+		err.write_err = write_err;
+	}
+	return err;
+}
+
 struct protocol_do_err protocol_do_read(protocol_read_func read_func,
 					struct conn *conn,
 					void **packet_data_ptr)
@@ -22,6 +22,9 @@ struct protocol_do_err {
 #define PROTOCOL_WRITE(PACKET_NAME, CONN, PACKET_DATA)                         \
 	protocol_do_write((protocol_write_func) protocol_write_##PACKET_NAME,  \
 			  CONN, PACKET_DATA)
+#define PROTOCOL_ENCODE(PACKET_NAME, PACKET, PACKET_DATA)                      \
+	protocol_do_encode((protocol_write_func) protocol_write_##PACKET_NAME, \
+			   PACKET, PACKET_DATA)
 #define PROTOCOL_READ(PACKET_NAME, CONN, DEST)                                 \
 	protocol_do_read((protocol_read_func) protocol_read_##PACKET_NAME,     \
 			 CONN, &(DEST))
@@ -37,6 +40,13 @@ struct protocol_do_err {
 
 struct protocol_do_err protocol_do_write(protocol_write_func, struct conn *,
 					 void *packet_data);
+/* Writes and finalizes a packet into the given packet buffer instead of a
+ * connection's, so it can be sent to lots of connections with
+ * protocol_do_write_finalized() after only being encoded once. */
+struct protocol_do_err protocol_do_encode(protocol_write_func, struct packet *,
+					  void *packet_data);
+struct protocol_do_err protocol_do_write_finalized(struct conn *,
+						   const struct packet *);
 struct protocol_do_err protocol_do_read(protocol_read_func, struct conn *,
 					void **packet_data_ptr);
 
@@ -1,21 +1,121 @@
 #include "server.h"
 
 #include "action.h"
+#include "blocks.h"
 #include "config.h"
+#include "lighting.h"
 #include "login.h"
 #include "mc.h"
 #include "protocol.h"
 #include "protocol_autogen.h"
 #include "strutil.h"
 #include "view.h"
+#include "watchdog.h"
 #include "world.h"
 
+#include <errno.h>
+#include <linux/sockios.h>
+#include <math.h>
 #include <poll.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <sys/ioctl.h>
 
 /* TODO: make a config.h file or smth for these settings */
 #define LEVEL_PATH "levels/default"
+/* how many blocks' worth of light get relit each tick, anything past that
+ * carries over to the next one */
+#define LIGHT_UPDATES_PER_TICK 65536
+
+#define ALL_SECTIONS_MASK ((1 << CHUNK_SECTIONS_LEN) - 1)
+
+/* queued chunks go out at about the rate each client takes them, within
+ * these limits. the minimum is there so a connection that's been idle doesn't
+ * have to work its way back up from nothing */
+#define CHUNK_BYTES_PER_TICK_MIN (32 * 1024)
+#define CHUNK_BYTES_PER_TICK_MAX (1024 * 1024)
+#define CHUNKS_PER_TICK_MAX	 64
+
+/* When a tick takes longer than VIEW_SHRINK_TICK_NSEC, or the server's
+ * sending more than VIEW_SHRINK_BYTES_PER_TICK, everyone's view distance gets
+ * cut by one. Once ticks have been under VIEW_GROW_TICK_NSEC for
+ * VIEW_GROW_AFTER_TICKS in a row, it goes back up by one. */
+#define VIEW_SHRINK_TICK_NSEC	   40000000
+#define VIEW_SHRINK_BYTES_PER_TICK (4 * 1024 * 1024)
+#define VIEW_GROW_TICK_NSEC	   20000000
+#define VIEW_GROW_AFTER_TICKS	   100
+/* the last cut gets this long to help before there's another one */
+#define VIEW_SHRINK_COOLDOWN_TICKS 20
+#define VIEW_DISTANCE_MIN	   2
+
+/* players moving slower than this many blocks per tick don't get anything
+ * prefetched, they'll be fine with what's loaded when they cross a border */
+#define PREFETCH_MIN_SPEED 0.2
+/* prefetch whatever'll come into view within this many ticks, but never more
+ * than PREFETCH_MAX_CHUNKS_AHEAD chunks ahead */
+#define PREFETCH_LOOKAHEAD_TICKS  60
+#define PREFETCH_MAX_CHUNKS_AHEAD 4
+
+/* how many chunks away players can see each other at 100%
+ * entity_broadcast_range_percentage, same as vanilla */
+#define PLAYER_TRACKING_RANGE 32
+
+/* relative moves are in 1/4096ths of a block, and have to fit in a short.
+ * anything further than that is a teleport */
+#define MOVE_UNITS_PER_BLOCK 4096
+
+/* how many different coalesced packet types can be waiting at once, see
+ * protocol_action.coalesce */
+#define COALESCED_MAX 8
+
+/* Each connection can send rate_limit (from server.properties) packets and
+ * BYTES_PER_SEC bytes a second, and can save up RATE_BURST_SECS worth for
+ * bursts. Anything over that waits in the socket, and a client that's still
+ * over it after THROTTLED_KICK_TICKS ticks in a row gets kicked. Like
+ * vanilla, a rate_limit of 0 turns all of this off. */
+#define BYTES_PER_SEC	     (256 * 1024)
+#define RATE_BURST_SECS	     2
+#define THROTTLED_KICK_TICKS 100
+/* no more than this many packets get read from one connection in a tick,
+ * whatever it has saved up */
+#define PACKETS_PER_TICK_MAX 64
+/* a minute's worth, same as the tick report */
+#define TRAFFIC_REPORT_TICKS 1200
+
+/* keep alives go out every KEEP_ALIVE_TICKS, and a client that hasn't
+ * answered one in KEEP_ALIVE_TIMEOUT_TICKS is gone. one that hasn't
+ * confirmed the teleport to spawn within JOIN_TIMEOUT_TICKS never finished
+ * joining */
+#define KEEP_ALIVE_TICKS	 60
+#define KEEP_ALIVE_TIMEOUT_TICKS 600
+#define JOIN_TIMEOUT_TICKS	 600
+/* player_idle_timeout is in minutes */
+#define TICKS_PER_MINUTE 1200
+
+static struct {
+	/* how much is taken off everyone's view distance */
+	int cut;
+	int quiet_ticks;
+	int cooldown;
+} view_load;
+
+struct rate_limit_stats rate_limit_stats;
+
+static struct {
+	unsigned ticks;
+	/* rate_limit_stats as of the last report */
+	struct rate_limit_stats last;
+} traffic_report;
+
+static int target_view_distance(const struct conn *conn)
+{
+	int target = conn->max_view_distance - view_load.cut;
+	if (target >= VIEW_DISTANCE_MIN)
+		return target;
+	return conn->max_view_distance < VIEW_DISTANCE_MIN
+		   ? conn->max_view_distance
+		   : VIEW_DISTANCE_MIN;
+}
 
 static struct conn *server_handshake(int sfd, struct packet *p)
 {
@@ -45,10 +145,42 @@ static struct conn *server_handshake(int sfd, struct packet *p)
 	}
 }
 
-static bool is_air(int blockstate)
+/* The heightmaps NBT is the same for every chunk apart from the longs in it,
+ * so there's only one, pointed at each chunk's heightmap as it's sent. */
+static struct nbt *heightmaps_nbt(struct chunk *chunk)
 {
-	/* TODO: don't hardcode these */
-	return blockstate == 0 || blockstate == 9129 || blockstate == 9130;
+	static struct nbt *nbt = NULL;
+	static struct nbt_array motion_blocking = { .type = TAG_Long,
+						    .len = HEIGHTMAP_LEN };
+	if (nbt == NULL) {
+		nbt = nbt_new(TAG_Long_Array, "MOTION_BLOCKING");
+		nbt_get(nbt, TAG_Long_Array, "MOTION_BLOCKING")->data.array =
+		    &motion_blocking;
+	}
+	motion_blocking.data.longs = chunk->heightmap;
+	return nbt;
+}
+
+/* what gets sent in place of a uniform section's blockstates; all zeroes
+ * points every block at palette[0] */
+static int64_t uniform_data_array[BLOCKSTATES_LEN(MIN_BITS_PER_BLOCK)];
+
+static int16_t section_block_count(const struct section *section)
+{
+	if (section_is_uniform(section) && block_is_air(section->palette[0]))
+		return 0;
+	else if (section_is_uniform(section))
+		return TOTAL_BLOCKSTATES;
+
+	uint16_t palette_idxs[TOTAL_BLOCKSTATES];
+	section_unpack(section, palette_idxs);
+	int16_t block_count = 0;
+	for (int b = 0; b < TOTAL_BLOCKSTATES; ++b) {
+		if (!block_is_air(section->palette[palette_idxs[b]])) {
+			++block_count;
+		}
+	}
+	return block_count;
 }
 
 static void write_chunk_to_packet(struct chunk_data *packet,
@@ -56,13 +188,13 @@ static void write_chunk_to_packet(struct chunk_data *packet,
 {
 	int primary_bit_mask = 0;
 	for (int i = 1; i < chunk->sections_len; ++i) {
-		int has_blocks = chunk->sections[i]->bits_per_block > 0;
+		int has_blocks = chunk->sections[i].bits_per_block > 0;
 		primary_bit_mask |= (has_blocks << (i - 1));
 	}
 	packet->primary_bit_mask = primary_bit_mask;
 	packet->data_len = 0;
 	for (int i = 0; i < chunk->sections_len; ++i) {
-		if (chunk->sections[i]->bits_per_block > 0) {
+		if (chunk->sections[i].bits_per_block > 0) {
 			++(packet->data_len);
 		}
 	}
@@ -76,35 +208,39 @@ static void write_chunk_to_packet(struct chunk_data *packet,
 			return;
 		}
 	}
-	packet->biomes = chunk->biomes;
+	static int32_t biomes[BIOMES_LEN];
+	for (int i = 0; i < BIOMES_LEN; ++i)
+		biomes[i] = chunk->biomes[i];
+	packet->biomes = biomes;
+	packet->heightmaps = heightmaps_nbt(chunk);
 	int j = 0;
 	for (int i = 0; i < chunk->sections_len; ++i) {
-		struct section *section = chunk->sections[i];
+		const struct section *section = &chunk->sections[i];
 		if (section->bits_per_block > 0) {
-			packet->data[j].block_count = 0;
-			for (int b = 0; b < TOTAL_BLOCKSTATES; ++b) {
-				int palette_idx = read_blockstate_at(
-				    section, b % 16, (b / 16) % 16,
-				    b / (16 * 16));
-				if (!is_air(section->palette[palette_idx])) {
-					++(packet->data[j].block_count);
-				}
-			}
+			packet->data[j].block_count =
+			    section_block_count(section);
 			packet->data[j].bits_per_block =
 			    section->bits_per_block;
 			packet->data[j].palette_len = section->palette_len;
 			packet->data[j].palette = section->palette;
 			packet->data[j].data_array_len =
 			    BLOCKSTATES_LEN(section->bits_per_block);
-			packet->data[j].data_array =
-			    (int64_t *) section->blockstates;
+			if (section_is_uniform(section)) {
+				packet->data[j].data_array = uniform_data_array;
+			} else {
+				packet->data[j].data_array =
+				    (int64_t *) section->blockstates;
+			}
 			++j;
 		}
 	}
 }
 
+/* only the sections in the masks get written. sections in them without any
+ * light are marked empty */
 static void write_light_data_to_packet(struct update_light *packet,
-				       const struct chunk *chunk)
+				       const struct chunk *chunk,
+				       uint32_t sky_mask, uint32_t block_mask)
 {
 	static struct update_light_sky_light sky_light[CHUNK_SECTIONS_LEN];
 	static struct update_light_block_light block_light[CHUNK_SECTIONS_LEN];
@@ -115,30 +251,26 @@ static void write_light_data_to_packet(struct update_light *packet,
 	packet->sky_light_mask = 0;
 	packet->block_light_mask = 0;
 	while (i < (size_t) chunk->sections_len) {
-		if (chunk->sections[i] != NULL) {
-			if (chunk->sections[i]->sky_light != NULL) {
-				packet->sky_light_mask |= 1 << i;
-				sky_light[sky_light_idx].bytes_len =
-				    SECTION_LIGHT_LEN;
-				sky_light[sky_light_idx].bytes =
-				    chunk->sections[i]->sky_light;
-				++sky_light_idx;
-			}
-			if (chunk->sections[i]->block_light != NULL) {
-				packet->block_light_mask |= 1 << i;
-				block_light[block_light_idx].bytes_len =
-				    SECTION_LIGHT_LEN;
-				block_light[block_light_idx].bytes =
-				    chunk->sections[i]->block_light;
-				++block_light_idx;
-			}
+		const struct section *section = &chunk->sections[i];
+		if (section->sky_light != NULL && (sky_mask & (1 << i))) {
+			packet->sky_light_mask |= 1 << i;
+			sky_light[sky_light_idx].bytes_len = SECTION_LIGHT_LEN;
+			sky_light[sky_light_idx].bytes = section->sky_light;
+			++sky_light_idx;
+		}
+		if (section->block_light != NULL && (block_mask & (1 << i))) {
+			packet->block_light_mask |= 1 << i;
+			block_light[block_light_idx].bytes_len =
+			    SECTION_LIGHT_LEN;
+			block_light[block_light_idx].bytes =
+			    section->block_light;
+			++block_light_idx;
 		}
 		++i;
 	}
-	packet->empty_sky_light_mask =
-	    ~packet->sky_light_mask & ((1 << CHUNK_SECTIONS_LEN) - 1);
+	packet->empty_sky_light_mask = ~packet->sky_light_mask & sky_mask;
 	packet->empty_block_light_mask =
-	    ~packet->block_light_mask & ((1 << CHUNK_SECTIONS_LEN) - 1);
+	    ~packet->block_light_mask & block_mask;
 	packet->sky_light_arrays = sky_light;
 	packet->block_light_arrays = block_light;
 }
@@ -153,16 +285,141 @@ static void mc_position_to_xyz(uint64_t pos, uint32_t *x, uint16_t *y,
 	*z = (pos >> 12) & 0x3FFFFFF;
 }
 
+/* sends a chunk's light and blocks. the packet and data_len are kept between
+ * calls so the sections array only gets reallocated when it has to grow */
+static void send_chunk(struct conn *conn, int c_x, int c_z,
+		       struct chunk *chunk, struct chunk_data *packet,
+		       int32_t *data_len)
+{
+	watchdog_note_chunk(c_x, c_z);
+	struct update_light light_packet = { .chunk_x = c_x, .chunk_z = c_z };
+	write_light_data_to_packet(&light_packet, chunk, ALL_SECTIONS_MASK,
+				   ALL_SECTIONS_MASK);
+	struct protocol_do_err err =
+	    PROTOCOL_WRITE(update_light, conn, &light_packet);
+	if (err.err_type != PROTOCOL_DO_ERR_SUCCESS) {
+		fprintf(stderr, "send_chunk(): failed to send light data for "
+				"chunk (%d,%d)\n",
+			c_x, c_z);
+	}
+
+	packet->full_chunk = true;
+	packet->chunk_x = c_x;
+	packet->chunk_z = c_z;
+	write_chunk_to_packet(packet, chunk, data_len);
+	err = PROTOCOL_WRITE(chunk_data, conn, packet);
+	if (err.err_type != PROTOCOL_DO_ERR_SUCCESS) {
+		fprintf(stderr, "send_chunk(): failed to send chunk data for "
+				"chunk (%d,%d)\n",
+			c_x, c_z);
+	}
+}
+
+/* adds the player to the client's player list, which it has to be in before
+ * the client can see it */
+static struct protocol_do_err write_player_info(struct conn *conn,
+						struct player *p)
+{
+	struct player_info_player player = { 0 };
+	memcpy(player.uuid, p->uuid, 16);
+	player.add_player.name = p->username;
+	player.add_player.properties_len = 1;
+	player.add_player.gamemode = 0;
+	player.add_player.ping = 0;
+	player.add_player.has_display_name = false;
+	struct player_info_property prop;
+	prop.name = "textures";
+	prop.value = p->textures;
+	prop.is_signed = false;
+	player.add_player.properties = &prop;
+	struct player_info info;
+	info.action = PLAYER_INFO_ACTION_ADD_PLAYER;
+	info.players_len = 1;
+	info.players = &player;
+	return PROTOCOL_WRITE(player_info, conn, &info);
+}
+
+/* the view around the chunk the connection's player is in */
+static struct view player_view(struct entities *entities, struct conn *conn)
+{
+	int i = ENTITY_INDEX(entities, conn->player->entity);
+	struct view view = {
+		.x = entities->c_x[i],
+		.z = entities->c_z[i],
+		.size = conn->view_distance,
+	};
+	return view;
+}
+
+static void send_keep_alive(struct timer_wheel *timers, void *data)
+{
+	struct conn *conn = data;
+	conn->keep_alive_id = rand();
+	struct cb_keep_alive keep_alive_pack = {
+		.keep_alive_id = conn->keep_alive_id
+	};
+	struct protocol_do_err err =
+	    PROTOCOL_WRITE(cb_keep_alive, conn, &keep_alive_pack);
+	if (err.err_type != PROTOCOL_DO_ERR_SUCCESS)
+		fprintf(stderr, "error sending keep alive\n");
+	timer_schedule(timers, &conn->keep_alive_timer, KEEP_ALIVE_TICKS,
+		       send_keep_alive, conn);
+}
+
+static void keep_alive_timed_out(struct timer_wheel *timers, void *data)
+{
+	(void) timers;
+	struct conn *conn = data;
+	puts("client hasn't sent a keep alive in a while, disconnecting");
+	conn->kick_reason = "disconnect.timeout";
+}
+
+static void join_timed_out(struct timer_wheel *timers, void *data)
+{
+	(void) timers;
+	struct conn *conn = data;
+	printf("%s took too long to join, disconnecting\n",
+	       conn->player->username);
+	conn->kick_reason = "multiplayer.disconnect.slow_login";
+}
+
+static void idle_timed_out(struct timer_wheel *timers, void *data)
+{
+	(void) timers;
+	struct conn *conn = data;
+	printf("%s has been idle for too long, kicking\n",
+	       conn->player->username);
+	conn->kick_reason = "multiplayer.disconnect.idling";
+}
+
 static int server_initialize_play_state(struct conn *conn, struct world *w)
 {
-	struct join_game join_packet = { .entity_id = 123, // TODO
+	struct entities *entities = world_entities(w);
+	// TODO: loading spawn should happen on server startup
+	uint64_t spawn_location = world_get_spawn(w);
+	uint32_t spawn_x = 0;
+	uint16_t spawn_y = 0;
+	uint32_t spawn_z = 0;
+	mc_position_to_xyz(spawn_location, &spawn_x, &spawn_y, &spawn_z);
+	/* added right at spawn, so joining doesn't count as a move */
+	conn->player->entity =
+	    entities_add(entities, conn, spawn_x, spawn_y, spawn_z);
+	if (conn->player->entity < 0) {
+		fprintf(stderr, "server_initialize_play_state(): couldn't add "
+				"player entity\n");
+		return -1;
+	}
+	int32_t entity_id =
+	    entities->ids[ENTITY_INDEX(entities, conn->player->entity)];
+	struct join_game join_packet = { .entity_id = entity_id,
 					 .gamemode = 1,
 					 .dimension =
 					     JOIN_GAME_DIMENSION_OVERWORLD,
 					 .hashed_seed = 0, // TODO
 					 .max_players = 4,
 					 .level_type = "default",
-					 .view_distance = 10,
+					 .view_distance =
+					     server_properties.view_distance,
 					 .reduced_debug_info = false,
 					 .enable_respawn_screen = true };
 	struct protocol_do_err err =
@@ -181,12 +438,23 @@ static int server_initialize_play_state(struct conn *conn, struct world *w)
 		    "server_initialize_play_state(): client_settings failed\n");
 		return -1;
 	}
-	/* FIXME: this should be the minimum of the client's preference and
-	 *        the server's view distance */
-	/* FIXME: conn->view_distance should be used pretty much everywhere
-	 *        'server_properties.view_distance' is referenced */
-	conn->view_distance = server_properties.view_distance;
+	conn_set_client_view_distance(conn, client_settings_pack.view_distance);
+	conn->view_distance = target_view_distance(conn);
 	free(client_settings_pack.locale);
+	/* join_game had to go out before the client said what it wants, so
+	 * it may have been told more than is going to be loaded */
+	if (conn->view_distance != (int) server_properties.view_distance) {
+		struct update_view_distance distance_pack = {
+			.view_distance = conn->view_distance
+		};
+		err = PROTOCOL_WRITE(update_view_distance, conn,
+				     &distance_pack);
+		if (err.err_type != PROTOCOL_DO_ERR_SUCCESS) {
+			fprintf(stderr, "server_initialize_play_state(): "
+					"failed to send update_view_distance\n");
+			return -1;
+		}
+	}
 	struct cb_held_item_change held_item_change_pack = { .slot = 0 };
 	err = PROTOCOL_WRITE(cb_held_item_change, conn, &held_item_change_pack);
 	if (err.err_type != PROTOCOL_DO_ERR_SUCCESS) {
@@ -202,14 +470,7 @@ static int server_initialize_play_state(struct conn *conn, struct world *w)
 		return -1;
 	}
 
-	// TODO: loading spawn should happen on server startup
-	uint64_t spawn_location = world_get_spawn(w);
-	uint32_t spawn_x = 0;
-	uint16_t spawn_y = 0;
-	uint32_t spawn_z = 0;
-	mc_position_to_xyz(spawn_location, &spawn_x, &spawn_y, &spawn_z);
-	if (world_load_chunks(w, spawn_x, spawn_z,
-			      server_properties.view_distance)
+	if (world_load_chunks(w, spawn_x, spawn_z, conn->view_distance)
 	    != ANVIL_OK) {
 		fprintf(stderr, "failed to load chunks\n");
 		return -1;
@@ -227,67 +488,22 @@ static int server_initialize_play_state(struct conn *conn, struct world *w)
 	conn->old_chunk_x = view_pack.chunk_x;
 	conn->old_chunk_z = view_pack.chunk_z;
 
-	struct update_light update_light_pack = { 0 };
-	struct chunk_data chunk_data_pack = { 0 };
-	chunk_data_pack.full_chunk = true;
-	/* TODO: calculate heightmaps / load them from the region file */
-	struct nbt *nbt = nbt_new(TAG_Long_Array, "MOTION_BLOCKING");
-	struct nbt_array *arr = malloc(sizeof(struct nbt_array));
-	int64_t heightmaps[36] = { 0 };
-	arr->len = 36;
-	arr->data.longs = heightmaps;
-	struct nbt *motion_blocking =
-	    nbt_get(nbt, TAG_Long_Array, "MOTION_BLOCKING");
-	motion_blocking->data.array = arr;
-	chunk_data_pack.heightmaps = nbt;
-	int32_t data_len = 0;
-	int c1_x =
-	    mc_coord_to_chunk(spawn_x - server_properties.view_distance * 16);
-	int c1_z =
-	    mc_coord_to_chunk(spawn_z - server_properties.view_distance * 16);
-	int c2_x =
-	    mc_coord_to_chunk(spawn_x + server_properties.view_distance * 16);
-	int c2_z =
-	    mc_coord_to_chunk(spawn_z + server_properties.view_distance * 16);
+	/* the chunks get sent over the next few ticks by
+	 * server_send_chunks() */
+	int c1_x = mc_coord_to_chunk(spawn_x - conn->view_distance * 16);
+	int c1_z = mc_coord_to_chunk(spawn_z - conn->view_distance * 16);
+	int c2_x = mc_coord_to_chunk(spawn_x + conn->view_distance * 16);
+	int c2_z = mc_coord_to_chunk(spawn_z + conn->view_distance * 16);
 	struct chunk *chunk = NULL;
 	for (int z = c1_z; z <= c2_z; ++z) {
 		for (int x = c1_x; x <= c2_x; ++x) {
 			chunk = world_chunk_at(w, x, z);
 			if (chunk != NULL) {
 				++chunk->player_count;
-
-				update_light_pack.chunk_x = x;
-				update_light_pack.chunk_z = z;
-				write_light_data_to_packet(&update_light_pack,
-							   chunk);
-				err = PROTOCOL_WRITE(update_light, conn,
-						     &update_light_pack);
-				if (err.err_type != PROTOCOL_DO_ERR_SUCCESS) {
-					fprintf(
-					    stderr,
-					    "server_initialize_play_state(): "
-					    "failed to send light data\n");
-				}
-
-				chunk_data_pack.chunk_x = x;
-				chunk_data_pack.chunk_z = z;
-				write_chunk_to_packet(&chunk_data_pack, chunk,
-						      &data_len);
-				err = PROTOCOL_WRITE(chunk_data, conn,
-						     &chunk_data_pack);
-				if (err.err_type != PROTOCOL_DO_ERR_SUCCESS) {
-					fprintf(stderr,
-						"server_initialize_play_state()"
-						": failed to send chunk data "
-						"for chunk (%d,%d)\n",
-						x, z);
-				}
+				chunk_queue_push(&conn->chunk_queue, x, z);
 			}
 		}
 	}
-	arr->data.longs = NULL;
-	nbt_free(nbt);
-	free(chunk_data_pack.data);
 
 	struct spawn_position spawn_pos;
 	spawn_pos.location = spawn_location;
@@ -310,27 +526,10 @@ static int server_initialize_play_state(struct conn *conn, struct world *w)
 				"send player_position_look failed\n");
 		return -1;
 	}
-	conn->player->x = spawn_x;
-	conn->player->y = spawn_y;
-	conn->player->z = spawn_z;
+	struct view view = player_view(entities, conn);
+	interest_grid_update(world_interest(w), conn, view.x, view.z);
 
-	struct player_info_player player = { 0 };
-	memcpy(player.uuid, conn->player->uuid, 16);
-	player.add_player.name = conn->player->username;
-	player.add_player.properties_len = 1;
-	player.add_player.gamemode = 0;
-	player.add_player.ping = 0;
-	player.add_player.has_display_name = false;
-	struct player_info_property prop;
-	prop.name = "textures";
-	prop.value = conn->player->textures;
-	prop.is_signed = false;
-	player.add_player.properties = &prop;
-	struct player_info info;
-	info.action = PLAYER_INFO_ACTION_ADD_PLAYER;
-	info.players_len = 1;
-	info.players = &player;
-	err = PROTOCOL_WRITE(player_info, conn, &info);
+	err = write_player_info(conn, conn->player);
 	if (err.err_type != PROTOCOL_DO_ERR_SUCCESS) {
 		fprintf(stderr, "server_initialize_play_state(): failed to "
 				"send player_position_look failed\n");
@@ -339,7 +538,14 @@ static int server_initialize_play_state(struct conn *conn, struct world *w)
 
 	puts("sent all of the shit, just waiting on a teleport confirm");
 
-	conn->last_pong = time(NULL);
+	struct timer_wheel *timers = world_timers(w);
+	timer_schedule(timers, &conn->keep_alive_timer, 1, send_keep_alive,
+		       conn);
+	timer_schedule(timers, &conn->timeout_timer, KEEP_ALIVE_TIMEOUT_TICKS,
+		       keep_alive_timed_out, conn);
+	timer_schedule(timers, &conn->join_timer, JOIN_TIMEOUT_TICKS,
+		       join_timed_out, conn);
+	server_player_active(conn, w);
 	return 0;
 }
 
@@ -361,6 +567,8 @@ struct conn *server_accept_connection(int sfd, struct packet *p,
 	err = server_initialize_play_state(c, w);
 	if (err < 0) {
 		fprintf(stderr, "error switching to play state: %d\n", err);
+		interest_grid_remove(world_interest(w), c);
+		entities_remove(world_entities(w), c->player->entity);
 		return NULL;
 	}
 	return c;
@@ -368,11 +576,7 @@ struct conn *server_accept_connection(int sfd, struct packet *p,
 
 static void server_end_play(struct conn *conn, struct world *world)
 {
-	struct view view = {
-		.x = mc_coord_to_chunk(conn->player->x),
-		.z = mc_coord_to_chunk(conn->player->z),
-		.size = conn->view_distance,
-	};
+	struct view view = player_view(world_entities(world), conn);
 	int vx, vz;
 	VIEW_FOREACH(view, vx, vz)
 	{
@@ -380,21 +584,123 @@ static void server_end_play(struct conn *conn, struct world *world)
 	}
 }
 
+/* a packet that's been read but is waiting to be acted on, in case a newer
+ * one of the same type turns up first */
+struct coalesced {
+	int packet_id;
+	void *data;
+};
+
+/* keeps only the newest of each type, in the order the newest ones arrived,
+ * so acting on them in order gets to the same state as acting on all of
+ * them would have. returns false if there's no room for another type, in
+ * which case it should just be acted on */
+static bool coalesce(struct coalesced *pending, int *len, int packet_id,
+		     void *data)
+{
+	int i = 0;
+	while (i < *len && pending[i].packet_id != packet_id)
+		++i;
+	if (i < *len) {
+		protocol_actions[packet_id].free(pending[i].data);
+		memmove(&pending[i], &pending[i + 1],
+			(*len - i - 1) * sizeof(struct coalesced));
+		--*len;
+	} else if (*len == COALESCED_MAX) {
+		return false;
+	}
+	pending[(*len)++] = (struct coalesced){ packet_id, data };
+	return true;
+}
+
+static void act_coalesced(struct conn *conn, struct world *w,
+			  struct coalesced *pending, int len)
+{
+	for (int i = 0; i < len; ++i) {
+		struct protocol_action action =
+		    protocol_actions[pending[i].packet_id];
+		action.act(conn, w, pending[i].data);
+		action.free(pending[i].data);
+	}
+}
+
+static void free_coalesced(struct coalesced *pending, int len)
+{
+	for (int i = 0; i < len; ++i)
+		protocol_actions[pending[i].packet_id].free(pending[i].data);
+}
+
+static void refill_tokens(struct conn *conn)
+{
+	struct timespec now;
+	if (clock_gettime(CLOCK_MONOTONIC, &now) < 0)
+		return;
+	double secs = (now.tv_sec - conn->tokens_refilled.tv_sec)
+		      + (now.tv_nsec - conn->tokens_refilled.tv_nsec) / 1e9;
+	conn->tokens_refilled = now;
+	double packet_rate = server_properties.rate_limit;
+	conn->packet_tokens = fmin(conn->packet_tokens + packet_rate * secs,
+				   packet_rate * RATE_BURST_SECS);
+	conn->byte_tokens = fmin(conn->byte_tokens + BYTES_PER_SEC * secs,
+				 BYTES_PER_SEC * RATE_BURST_SECS);
+}
+
+static void kick(struct conn *conn, const char *reason)
+{
+	struct disconnect packet;
+	if (asprintf(&packet.reason, "{\"translate\":\"%s\"}", reason) < 0)
+		return;
+	struct protocol_do_err err = PROTOCOL_WRITE(disconnect, conn, &packet);
+	if (err.err_type != PROTOCOL_DO_ERR_SUCCESS)
+		fprintf(stderr, "failed to write disconnect :(\n");
+	free(packet.reason);
+}
+
 int server_play(struct conn *conn, struct world *w)
 {
 	struct pollfd pfd = { .fd = conn->sfd, .events = POLLIN };
 	int polled;
 	struct protocol_err err = { 0 };
+	struct coalesced pending[COALESCED_MAX];
+	int pending_len = 0;
+	int packets = 0;
+	bool throttled = false;
+	const bool limited = server_properties.rate_limit > 0;
+	watchdog_note_conn(conn->sfd);
+	if (conn->kick_reason != NULL) {
+		kick(conn, conn->kick_reason);
+		server_end_play(conn, w);
+		return 0;
+	}
+	if (limited)
+		refill_tokens(conn);
 	while ((polled = poll(&pfd, 1, 0)) > 0 && (pfd.revents & POLLIN)) {
+		/* whatever's left stays in the socket until next tick */
+		if (limited
+		    && (conn->packet_tokens < 1 || conn->byte_tokens <= 0)) {
+			throttled = true;
+			break;
+		} else if (packets == PACKETS_PER_TICK_MAX) {
+			break;
+		}
 		int result = conn_packet_read_header(conn);
 		if (result == 0) {
 			puts("client closed connection");
+			free_coalesced(pending, pending_len);
 			server_end_play(conn, w);
 			return 0;
 		} else if (result < 0) {
 			fprintf(stderr, "error parsing packet\n");
+			free_coalesced(pending, pending_len);
 			return -1;
 		}
+		++packets;
+		conn->packet_tokens -= 1;
+		conn->byte_tokens -= conn->packet->packet_len;
+		conn->packets_in += 1;
+		conn->bytes_in += conn->packet->packet_len;
+		rate_limit_stats.packets_in += 1;
+		rate_limit_stats.bytes_in += conn->packet->packet_len;
 		struct protocol_action action =
 		    protocol_actions[conn->packet->packet_id];
 		if (action.name != NULL) {
@@ -404,6 +710,10 @@ int server_play(struct conn *conn, struct world *w)
 				fprintf(stderr,
 					"server_play(): error reading %s\n",
 					action.name);
+			} else if (action.coalesce
+				   && coalesce(pending, &pending_len,
+					       conn->packet->packet_id, data)) {
+				continue;
 			} else {
 				action.act(conn, w, data);
 				if (action.sends_message) {
@@ -411,10 +721,8 @@ int server_play(struct conn *conn, struct world *w)
 					    message_new(conn->player,
 							conn->packet->packet_id,
 							data, action.free);
-					// FIXME: i hate list_append
-					list_append(conn->messages_out,
-						    sizeof(struct message *),
-						    &msg);
+					queue_push(&conn->messages_out,
+						   &msg->node);
 				} else {
 					action.free(data);
 				}
@@ -424,52 +732,163 @@ int server_play(struct conn *conn, struct world *w)
 			       conn->packet->packet_id);
 		}
 	}
-	if (polled < 0) {
-		perror("poll");
-		return -1;
+	if (!throttled) {
+		conn->throttled_ticks = 0;
+	} else {
+		++rate_limit_stats.throttled_ticks;
+		++conn->throttled_ticks;
 	}
-
-	if (time(NULL) - conn->last_pong > 30) {
-		puts("client hasn't sent a keep alive in a while, "
-		     "disconnecting");
+	if (conn->throttled_ticks >= THROTTLED_KICK_TICKS) {
+		printf("%s is sending too much, kicking\n",
+		       conn->player->username);
+		free_coalesced(pending, pending_len);
+		kick(conn, "disconnect.exceeded_packet_rate");
+		++rate_limit_stats.kicks;
 		server_end_play(conn, w);
 		return 0;
 	}
+	act_coalesced(conn, w, pending, pending_len);
+	/* poll() isn't restarted after a signal, even with SA_RESTART, and
+	 * the watchdog's SIGUSR1 can land here. whatever's there will still
+	 * be there next tick */
+	if (polled < 0 && errno != EINTR) {
+		perror("poll");
+		return -1;
+	}
+	return 1;
+}
 
-	if (time(NULL) - conn->last_ping > 3) {
-		conn->keep_alive_id = rand();
-		struct cb_keep_alive keep_alive_pack = {
-			.keep_alive_id = conn->keep_alive_id
-		};
-		struct protocol_do_err do_err =
-		    PROTOCOL_WRITE(cb_keep_alive, conn, &keep_alive_pack);
-		if (do_err.err_type != PROTOCOL_DO_ERR_SUCCESS) {
-			fprintf(stderr,
-				"server_play(): error sending keep alive\n");
-			return -1;
+void server_report_traffic(struct vector *connections)
+{
+	if (++traffic_report.ticks < TRAFFIC_REPORT_TICKS)
+		return;
+	struct rate_limit_stats *last = &traffic_report.last;
+	uint64_t throttled =
+	    rate_limit_stats.throttled_ticks - last->throttled_ticks;
+	uint64_t kicks = rate_limit_stats.kicks - last->kicks;
+	uint64_t packets = rate_limit_stats.packets_in - last->packets_in;
+	uint64_t kib = (rate_limit_stats.bytes_in - last->bytes_in) / 1024;
+	/* nothing worth mentioning unless someone's been held back */
+	if (throttled > 0 || kicks > 0) {
+		printf("WARN: %llu packets (%llu KiB) in over the last %u "
+		       "ticks, %llu throttled ticks, %llu kicked\n",
+		       (unsigned long long) packets, (unsigned long long) kib,
+		       traffic_report.ticks, (unsigned long long) throttled,
+		       (unsigned long long) kicks);
+		for (size_t i = 0; i < connections->len; ++i) {
+			struct conn *c =
+			    VECTOR_AT(connections, struct conn *, i);
+			printf("  %-16s %llu packets (%llu KiB) since joining"
+			       "%s\n",
+			       c->player->username,
+			       (unsigned long long) c->packets_in,
+			       (unsigned long long) c->bytes_in / 1024,
+			       c->throttled_ticks > 0 ? ", throttled" : "");
 		}
-		conn->last_ping = time(NULL);
 	}
-	return 1;
+	*last = rate_limit_stats;
+	traffic_report.ticks = 0;
+}
+
+void server_keep_alive_answered(struct conn *conn, struct world *world)
+{
+	timer_schedule(world_timers(world), &conn->timeout_timer,
+		       KEEP_ALIVE_TIMEOUT_TICKS, keep_alive_timed_out, conn);
+}
+
+void server_player_active(struct conn *conn, struct world *world)
+{
+	if (server_properties.player_idle_timeout == 0)
+		return;
+	timer_schedule(world_timers(world), &conn->idle_timer,
+		       (uint64_t) server_properties.player_idle_timeout
+			   * TICKS_PER_MINUTE,
+		       idle_timed_out, conn);
+}
+
+struct nearby_message {
+	const struct packet *frame;
+	struct player *from;
+	int c_x;
+	int c_z;
+	struct protocol_do_err err;
+};
+
+static int player_tracking_range()
+{
+	int range = PLAYER_TRACKING_RANGE
+		    * server_properties.entity_broadcast_range_percentage / 100;
+	if (range > (int) server_properties.view_distance)
+		range = server_properties.view_distance;
+	return range > 0 ? range : 1;
+}
+
+/* whether a player in the given chunk is something the connection should
+ * know about. everything found with interest_grid_nearby() and
+ * player_tracking_range() is in range, but not necessarily close enough for
+ * the connection to see */
+static bool can_see(const struct conn *conn, int c_x, int c_z)
+{
+	int range = player_tracking_range();
+	if (range > conn->view_distance)
+		range = conn->view_distance;
+	return abs(conn->cell_x - c_x) <= range
+	       && abs(conn->cell_z - c_z) <= range;
+}
+
+static void write_to_nearby(struct conn *conn, void *data)
+{
+	struct nearby_message *msg = data;
+	if (msg->err.err_type == PROTOCOL_DO_ERR_SUCCESS
+	    && conn->player != msg->from && can_see(conn, msg->c_x, msg->c_z))
+		msg->err = protocol_do_write_finalized(conn, msg->frame);
 }
 
-struct protocol_do_err server_send_messages(struct list *connections,
-					    struct list *messages)
+static struct protocol_do_err send_nearby(struct world *world,
+					  struct message *msg,
+					  const struct packet *frame)
+{
+	struct entities *entities = world_entities(world);
+	int i = ENTITY_INDEX(entities, msg->from->entity);
+	struct nearby_message nearby = {
+		.frame = frame,
+		.from = msg->from,
+		.c_x = entities->c_x[i],
+		.c_z = entities->c_z[i],
+	};
+	interest_grid_nearby(world_interest(world), nearby.c_x, nearby.c_z,
+			     player_tracking_range(), write_to_nearby, &nearby);
+	return nearby.err;
+}
+
+struct protocol_do_err server_send_messages(struct vector *connections,
+					    struct world *world,
+					    struct queue *messages)
 {
 	struct protocol_do_err err = { 0 };
-	while (!list_empty(messages)
-	       && err.err_type == PROTOCOL_DO_ERR_SUCCESS) {
-		struct list *conns = connections;
-		struct message *msg = list_remove(messages);
+	/* everyone gets the same packet, so it's only encoded once, into
+	 * here */
+	struct packet frame;
+	packet_init(&frame);
+	struct queue_node *node;
+	while (err.err_type == PROTOCOL_DO_ERR_SUCCESS
+	       && (node = queue_pop(messages)) != NULL) {
+		struct message *msg = QUEUE_ITEM(node, struct message, node);
 		struct message_action action = message_actions[msg->packet_id];
 		if (action.name != NULL) {
 			void *packet = action.message_to_packet(msg);
-			while (!list_empty(conns)
-			       && err.err_type == PROTOCOL_DO_ERR_SUCCESS) {
-				struct conn *conn = list_item(conns);
-				err = protocol_do_write(action.write, conn,
-							packet);
-				conns = list_next(conns);
+			err = protocol_do_encode(action.write, &frame, packet);
+			if (action.scope == MESSAGE_NEARBY
+			    && err.err_type == PROTOCOL_DO_ERR_SUCCESS)
+				err = send_nearby(world, msg, &frame);
+			for (size_t i = 0;
+			     action.scope == MESSAGE_GLOBAL
+			     && i < connections->len
+			     && err.err_type == PROTOCOL_DO_ERR_SUCCESS;
+			     ++i) {
+				struct conn *conn =
+				    VECTOR_AT(connections, struct conn *, i);
+				err = protocol_do_write_finalized(conn, &frame);
 			}
 			action.free(packet);
 		} else {
@@ -478,108 +897,475 @@ struct protocol_do_err server_send_messages(struct list *connections,
 		}
 		message_free(msg);
 	}
+	free(frame.data);
 	return err;
 }
 
-/* FIXME: once again, the errors suck. there needs to be a giant combined error
- *        type or something */
-int server_update_view(struct conn *conn, struct world *world)
+static int64_t to_move_units(double coord)
 {
-	int new_chunk_x = mc_coord_to_chunk(conn->player->x);
-	int new_chunk_z = mc_coord_to_chunk(conn->player->z);
-	assert(new_chunk_x != conn->old_chunk_x
-	       || new_chunk_z != conn->old_chunk_z);
+	return llround(coord * MOVE_UNITS_PER_BLOCK);
+}
 
-	struct update_view_position view_pos;
-	view_pos.chunk_x = new_chunk_x;
-	view_pos.chunk_z = new_chunk_z;
-	struct protocol_do_err err =
-	    PROTOCOL_WRITE(update_view_position, conn, &view_pos);
+/* angles are sent as 1/256ths of a turn */
+static uint8_t to_angle(float degrees)
+{
+	return (int) floorf(degrees / 360 * 256) & 0xFF;
+}
+
+static bool fits_in_short(int64_t n)
+{
+	return n >= INT16_MIN && n <= INT16_MAX;
+}
+
+static int compare_entity_ids(const void *a, const void *b)
+{
+	int32_t id_a = *(const int32_t *) a;
+	int32_t id_b = *(const int32_t *) b;
+	return (id_a > id_b) - (id_a < id_b);
+}
+
+static bool is_tracking(const struct conn *conn, int32_t entity_id)
+{
+	return conn->tracking_len > 0
+	       && bsearch(&entity_id, conn->tracking, conn->tracking_len,
+			  sizeof(int32_t), compare_entity_ids)
+		      != NULL;
+}
+
+/* Encodes the smallest packet that gets entity i from where everyone was
+ * last told it is to where it is now, or returns false if it hasn't gone
+ * anywhere. Rotations are only sent when they've changed, and moves that
+ * don't fit in a relative move are sent as teleports. */
+static bool encode_movement(struct entities *e, int i, struct packet *frame,
+			    struct packet *head_frame, bool *turned_head)
+{
+	int64_t x = to_move_units(e->x[i]);
+	int64_t y = to_move_units(e->y[i]);
+	int64_t z = to_move_units(e->z[i]);
+	uint8_t yaw = to_angle(e->yaw[i]);
+	uint8_t pitch = to_angle(e->pitch[i]);
+	int64_t dx = x - e->sent_x[i];
+	int64_t dy = y - e->sent_y[i];
+	int64_t dz = z - e->sent_z[i];
+	bool moved = dx != 0 || dy != 0 || dz != 0;
+	bool turned = yaw != e->sent_yaw[i] || pitch != e->sent_pitch[i];
+	if (!moved && !turned)
+		return false;
+
+	bool on_ground = e->flags[i] & ENTITY_ON_GROUND;
+	struct protocol_do_err err;
+	if (!fits_in_short(dx) || !fits_in_short(dy) || !fits_in_short(dz)) {
+		struct entity_teleport packet = {
+			.entity_id = e->ids[i],
+			.x = (double) x / MOVE_UNITS_PER_BLOCK,
+			.y = (double) y / MOVE_UNITS_PER_BLOCK,
+			.z = (double) z / MOVE_UNITS_PER_BLOCK,
+			.yaw = yaw,
+			.pitch = pitch,
+			.on_ground = on_ground,
+		};
+		err = PROTOCOL_ENCODE(entity_teleport, frame, &packet);
+	} else if (moved && turned) {
+		struct entity_position_rotation packet = {
+			.entity_id = e->ids[i],
+			.delta_x = dx,
+			.delta_y = dy,
+			.delta_z = dz,
+			.yaw = yaw,
+			.pitch = pitch,
+			.on_ground = on_ground,
+		};
+		err = PROTOCOL_ENCODE(entity_position_rotation, frame, &packet);
+	} else if (moved) {
+		struct entity_position packet = {
+			.entity_id = e->ids[i],
+			.delta_x = dx,
+			.delta_y = dy,
+			.delta_z = dz,
+			.on_ground = on_ground,
+		};
+		err = PROTOCOL_ENCODE(entity_position, frame, &packet);
+	} else {
+		struct entity_rotation packet = {
+			.entity_id = e->ids[i],
+			.yaw = yaw,
+			.pitch = pitch,
+			.on_ground = on_ground,
+		};
+		err = PROTOCOL_ENCODE(entity_rotation, frame, &packet);
+	}
+	/* the body turning doesn't turn the head, that's its own packet */
+	*turned_head = yaw != e->sent_yaw[i];
+	if (err.err_type == PROTOCOL_DO_ERR_SUCCESS && *turned_head) {
+		struct entity_head_look packet = { .entity_id = e->ids[i],
+						   .head_yaw = yaw };
+		err = PROTOCOL_ENCODE(entity_head_look, head_frame, &packet);
+	}
 	if (err.err_type != PROTOCOL_DO_ERR_SUCCESS) {
-		fprintf(stderr,
-			"failed to write update_view_position packet :(\n");
-		return -1;
+		fprintf(stderr, "failed to encode movement :(\n");
+		return false;
+	}
+	e->sent_x[i] = x;
+	e->sent_y[i] = y;
+	e->sent_z[i] = z;
+	e->sent_yaw[i] = yaw;
+	e->sent_pitch[i] = pitch;
+	return true;
+}
+
+struct movement {
+	struct conn *from;
+	int32_t entity_id;
+	int c_x;
+	int c_z;
+	const struct packet *frame;
+	/* NULL if the head didn't turn */
+	const struct packet *head_frame;
+};
+
+static void write_movement(struct conn *conn, void *data)
+{
+	struct movement *m = data;
+	if (conn == m->from || !can_see(conn, m->c_x, m->c_z)
+	    || !is_tracking(conn, m->entity_id))
+		return;
+	struct protocol_do_err err =
+	    protocol_do_write_finalized(conn, m->frame);
+	if (err.err_type == PROTOCOL_DO_ERR_SUCCESS && m->head_frame != NULL)
+		err = protocol_do_write_finalized(conn, m->head_frame);
+	if (err.err_type != PROTOCOL_DO_ERR_SUCCESS)
+		fprintf(stderr, "failed to write movement :(\n");
+}
+
+static void replicate_movement(struct entities *e, int i,
+			       struct interest_grid *grid, struct packet *frame,
+			       struct packet *head_frame)
+{
+	bool turned_head;
+	if (!e->conns[i]->in_grid
+	    || !encode_movement(e, i, frame, head_frame, &turned_head))
+		return;
+	struct movement m = {
+		.from = e->conns[i],
+		.entity_id = e->ids[i],
+		.c_x = e->c_x[i],
+		.c_z = e->c_z[i],
+		.frame = frame,
+		.head_frame = turned_head ? head_frame : NULL,
+	};
+	interest_grid_nearby(grid, m.c_x, m.c_z, player_tracking_range(),
+			     write_movement, &m);
+}
+
+struct visible {
+	struct entities *entities;
+	struct conn *conn;
+	int32_t *entity_ids;
+	int len;
+	int cap;
+};
+
+static void send_spawn_player(struct conn *conn, struct entities *e,
+			      struct player *p)
+{
+	int i = ENTITY_INDEX(e, p->entity);
+	struct spawn_player packet = {
+		.entity_id = e->ids[i],
+		.x = (double) e->sent_x[i] / MOVE_UNITS_PER_BLOCK,
+		.y = (double) e->sent_y[i] / MOVE_UNITS_PER_BLOCK,
+		.z = (double) e->sent_z[i] / MOVE_UNITS_PER_BLOCK,
+		.yaw = e->sent_yaw[i],
+		.pitch = e->sent_pitch[i],
+	};
+	memcpy(packet.uuid, p->uuid, 16);
+	struct protocol_do_err err = write_player_info(conn, p);
+	if (err.err_type == PROTOCOL_DO_ERR_SUCCESS)
+		err = PROTOCOL_WRITE(spawn_player, conn, &packet);
+	if (err.err_type != PROTOCOL_DO_ERR_SUCCESS)
+		fprintf(stderr, "failed to spawn player :(\n");
+}
+
+static void add_visible(struct conn *other, void *data)
+{
+	struct visible *v = data;
+	if (other == v->conn || !can_see(v->conn, other->cell_x, other->cell_z))
+		return;
+	if (v->len == v->cap) {
+		int new_cap = v->cap == 0 ? 8 : v->cap * 2;
+		int32_t *new_ids =
+		    realloc(v->entity_ids, new_cap * sizeof(int32_t));
+		if (new_ids == NULL)
+			return;
+		v->entity_ids = new_ids;
+		v->cap = new_cap;
+	}
+	int32_t entity_id =
+	    v->entities->ids[ENTITY_INDEX(v->entities, other->player->entity)];
+	v->entity_ids[v->len++] = entity_id;
+	if (!is_tracking(v->conn, entity_id))
+		send_spawn_player(v->conn, v->entities, other->player);
+}
+
+/* spawns the players that have come into range for the client, and
+ * destroys the ones that have gone out of it or left */
+static void update_tracking(struct conn *conn, struct entities *entities,
+			    struct interest_grid *grid)
+{
+	if (!conn->in_grid)
+		return;
+	struct visible v = { .entities = entities, .conn = conn };
+	interest_grid_nearby(grid, conn->cell_x, conn->cell_z,
+			     player_tracking_range(), add_visible, &v);
+	qsort(v.entity_ids, v.len, sizeof(int32_t), compare_entity_ids);
+
+	/* both are sorted, so anything that isn't visible anymore can be
+	 * found in one pass. they're moved to the front of the old array,
+	 * which isn't needed after this */
+	int gone = 0;
+	for (int i = 0, j = 0; i < conn->tracking_len; ++i) {
+		while (j < v.len && v.entity_ids[j] < conn->tracking[i])
+			++j;
+		if (j == v.len || v.entity_ids[j] != conn->tracking[i])
+			conn->tracking[gone++] = conn->tracking[i];
+	}
+	if (gone > 0) {
+		struct destroy_entities packet = {
+			.entity_ids_len = gone,
+			.entity_ids = conn->tracking,
+		};
+		struct protocol_do_err err =
+		    PROTOCOL_WRITE(destroy_entities, conn, &packet);
+		if (err.err_type != PROTOCOL_DO_ERR_SUCCESS)
+			fprintf(stderr, "failed to destroy players :(\n");
+	}
+	free(conn->tracking);
+	conn->tracking = v.entity_ids;
+	conn->tracking_len = v.len;
+	conn->tracking_cap = v.cap;
+}
+
+void server_replicate_players(struct world *world)
+{
+	struct entities *entities = world_entities(world);
+	struct interest_grid *grid = world_interest(world);
+	struct packet frame;
+	struct packet head_frame;
+	packet_init(&frame);
+	packet_init(&head_frame);
+	/* movement goes first, so everyone that's already tracking a player
+	 * is up to date with it before anyone new gets spawned where it is
+	 * now */
+	for (int i = 0; i < entities->len; ++i)
+		replicate_movement(entities, i, grid, &frame, &head_frame);
+	for (int i = 0; i < entities->len; ++i)
+		update_tracking(entities->conns[i], entities, grid);
+	free(frame.data);
+	free(head_frame.data);
+}
+
+static void send_light_update(int c_x, int c_z, struct chunk *chunk,
+			      uint32_t sky_mask, uint32_t block_mask,
+			      void *data)
+{
+	struct entities *entities = data;
+	struct update_light packet = { .chunk_x = c_x, .chunk_z = c_z };
+	write_light_data_to_packet(&packet, chunk, sky_mask, block_mask);
+	for (int i = 0; i < entities->len; ++i) {
+		struct conn *conn = entities->conns[i];
+		struct view view = {
+			.x = entities->c_x[i],
+			.z = entities->c_z[i],
+			.size = conn->view_distance,
+		};
+		if (VIEW_CONTAINS(view, c_x, c_z)) {
+			struct protocol_do_err err =
+			    PROTOCOL_WRITE(update_light, conn, &packet);
+			if (err.err_type != PROTOCOL_DO_ERR_SUCCESS) {
+				fprintf(stderr,
+					"failed to write light update :(\n");
+			}
+		}
+	}
+}
+
+void server_send_generated(struct world *world)
+{
+	struct entities *entities = world_entities(world);
+	struct chunk *chunk;
+	int c_x, c_z;
+	while ((chunk = world_take_generated(world, &c_x, &c_z)) != NULL) {
+		for (int i = 0; i < entities->len; ++i) {
+			struct conn *conn = entities->conns[i];
+			struct view view = {
+				.x = entities->c_x[i],
+				.z = entities->c_z[i],
+				.size = conn->view_distance,
+			};
+			if (VIEW_CONTAINS(view, c_x, c_z)) {
+				++chunk->player_count;
+				chunk_queue_push(&conn->chunk_queue, c_x, c_z);
+			}
+		}
+		/* if nobody can see it, it's either been prefetched or
+		 * everyone that wanted it has moved on already. either way
+		 * world_update_background() unloads it if nobody turns up */
 	}
+}
+
+/* returns how much of what's been written to the socket hasn't been sent yet,
+ * or 0 if there's no way of telling */
+static size_t unsent_bytes(int sfd)
+{
+	int unsent;
+	if (ioctl(sfd, SIOCOUTQ, &unsent) < 0)
+		return 0;
+	return unsent;
+}
 
+static void send_queued_chunks(struct conn *conn, struct world *world,
+			       struct chunk_data *packet, int32_t *data_len)
+{
+	watchdog_note_conn(conn->sfd);
+	/* whatever left the socket since last tick is what the client, and
+	 * everything between it and us, managed to take */
+	size_t unsent = unsent_bytes(conn->sfd);
+	size_t sent =
+	    conn->last_unsent + (conn->bytes_out - conn->last_bytes_out);
+	size_t drained = sent > unsent ? sent - unsent : 0;
+	conn->drain_rate = (conn->drain_rate * 3 + drained) / 4;
+
+	/* twice the drain rate, so the rate can keep ramping up while the
+	 * client keeps up, less whatever's still waiting to go out */
+	size_t budget = conn->drain_rate * 2;
+	if (budget < CHUNK_BYTES_PER_TICK_MIN)
+		budget = CHUNK_BYTES_PER_TICK_MIN;
+	else if (budget > CHUNK_BYTES_PER_TICK_MAX)
+		budget = CHUNK_BYTES_PER_TICK_MAX;
+	budget = budget > unsent ? budget - unsent : 0;
+
+	uint64_t start = conn->bytes_out;
+	struct view view = player_view(world_entities(world), conn);
+	struct chunk_pos pos;
+	for (int n = 0; n < CHUNKS_PER_TICK_MAX
+			&& conn->bytes_out - start < budget
+			&& chunk_queue_pop(&conn->chunk_queue, view.x, view.z,
+					   &pos);
+	     ++n) {
+		/* queued chunks have this player counted, so they stay
+		 * loaded until they're sent or out of view */
+		struct chunk *chunk = world_chunk_at(world, pos.x, pos.z);
+		if (chunk != NULL)
+			send_chunk(conn, pos.x, pos.z, chunk, packet, data_len);
+	}
+	conn->last_bytes_out = conn->bytes_out;
+	conn->last_unsent = unsent_bytes(conn->sfd);
+}
+
+void server_send_chunks(struct vector *connections, struct world *world)
+{
+	struct chunk_data packet = { 0 };
+	int32_t data_len = 0;
+	for (size_t i = 0; i < connections->len; ++i) {
+		send_queued_chunks(VECTOR_AT(connections, struct conn *, i),
+				   world, &packet, &data_len);
+	}
+	free(packet.data);
+}
+
+static void prefetch_ahead(struct entities *e, int i, struct world *world)
+{
+	/* clients send their position every tick while they're moving, so
+	 * no update means they've stopped, or close to it */
+	if (!(e->flags[i] & ENTITY_MOVED)) {
+		e->vel_x[i] /= 2;
+		e->vel_z[i] /= 2;
+	}
+	e->flags[i] &= ~ENTITY_MOVED;
+
+	double speed =
+	    sqrt(e->vel_x[i] * e->vel_x[i] + e->vel_z[i] * e->vel_z[i]);
+	if (speed < PREFETCH_MIN_SPEED)
+		return;
+	int ahead = ceil(speed * PREFETCH_LOOKAHEAD_TICKS / 16);
+	if (ahead > PREFETCH_MAX_CHUNKS_AHEAD)
+		ahead = PREFETCH_MAX_CHUNKS_AHEAD;
+
+	struct view view = {
+		.x = e->c_x[i],
+		.z = e->c_z[i],
+		.size = e->conns[i]->view_distance,
+	};
+	struct view prev = view;
+	/* one chunk further along at a time, so the nearest strip of new
+	 * chunks gets asked for first */
+	for (int step = 1; step <= ahead; ++step) {
+		double ticks = 16.0 * step / speed;
+		struct view next = {
+			.x = mc_coord_to_chunk(e->x[i] + e->vel_x[i] * ticks),
+			.z = mc_coord_to_chunk(e->z[i] + e->vel_z[i] * ticks),
+			.size = view.size,
+		};
+		int vx, vz;
+		VIEW_FOREACH(next, vx, vz)
+		{
+			if (!VIEW_CONTAINS(view, vx, vz)
+			    && !VIEW_CONTAINS(prev, vx, vz))
+				world_prefetch_chunk(world, vx, vz);
+		}
+		prev = next;
+	}
+}
+
+void server_prefetch_chunks(struct world *world)
+{
+	struct entities *entities = world_entities(world);
+	for (int i = 0; i < entities->len; ++i)
+		prefetch_ahead(entities, i, world);
+	world_update_background(world);
+}
+
+void server_update_light(struct world *world)
+{
+	/* light that's only half relit would be sent with holes in it, and
+	 * then again every tick until it's done */
+	if (lighting_update(world, LIGHT_UPDATES_PER_TICK))
+		lighting_flush(world, send_light_update,
+			       world_entities(world));
+}
+
+/* Loads and queues the chunks that are in the new view but not the old one,
+ * and unloads the ones that are only in the old one */
+static int move_view(struct conn *conn, struct world *world,
+		     struct view old_view, struct view new_view)
+{
 	enum anvil_err load_err = world_load_chunks(
-	    world, conn->player->x, conn->player->z, conn->view_distance);
+	    world, new_view.x * 16, new_view.z * 16, new_view.size);
 	if (load_err != ANVIL_OK) {
 		fprintf(stderr, "failed to load chunks updating view\n");
 		return -1;
 	}
 
-	struct view old_view = {
-		.x = conn->old_chunk_x,
-		.z = conn->old_chunk_z,
-		.size = conn->view_distance,
-	};
-	struct view new_view = {
-		.x = new_chunk_x,
-		.z = new_chunk_z,
-		.size = conn->view_distance,
-	};
-
-	struct update_light light_data = { 0 };
-	/* FIXME: the packets written here should probably be put into a queue
-	 *        on the connection for writing later so errors don't have to
-	 *        be handled here */
-	struct chunk_data chunk_data = { 0 };
-	chunk_data.full_chunk = true;
-
-	/* FIXME: these heightmaps really need to be handled properly, man */
-	struct nbt *nbt = nbt_new(TAG_Long_Array, "MOTION_BLOCKING");
-	struct nbt_array *arr = malloc(sizeof(struct nbt_array));
-	int64_t heightmaps[36] = { 0 };
-	arr->len = 36;
-	arr->data.longs = heightmaps;
-	struct nbt *motion_blocking =
-	    nbt_get(nbt, TAG_Long_Array, "MOTION_BLOCKING");
-	motion_blocking->data.array = arr;
-	chunk_data.heightmaps = nbt;
-
 	struct chunk *chunk;
-	int32_t chunk_data_len = 0;
 	int view_x;
 	int view_z;
 	VIEW_FOREACH(new_view, view_x, view_z)
 	{
 		if (!VIEW_CONTAINS(old_view, view_x, view_z)) {
 			chunk = world_chunk_at(world, view_x, view_z);
+			/* chunks that are still being generated get queued
+			 * by server_send_generated() */
 			if (chunk != NULL) {
 				++chunk->player_count;
-
-				light_data.chunk_x = view_x;
-				light_data.chunk_z = view_z;
-				write_light_data_to_packet(&light_data, chunk);
-				err = PROTOCOL_WRITE(update_light, conn,
-						     &light_data);
-				if (err.err_type != PROTOCOL_DO_ERR_SUCCESS) {
-					fprintf(stderr, "failed to write light "
-							"data!!! :(\n");
-				}
-
-				chunk_data.chunk_x = view_x;
-				chunk_data.chunk_z = view_z;
-				write_chunk_to_packet(&chunk_data, chunk,
-						      &chunk_data_len);
-				err = PROTOCOL_WRITE(chunk_data, conn,
-						     &chunk_data);
-				if (err.err_type != PROTOCOL_DO_ERR_SUCCESS) {
-					fprintf(
-					    stderr,
-					    "failed to write view chunk :(\n");
-				}
-			} else {
-				fprintf(stderr, "null chunky :( (%d,%d)\n",
-					view_x, view_z);
+				chunk_queue_push(&conn->chunk_queue, view_x,
+						 view_z);
 			}
 		}
 	}
-	free(chunk_data.data);
-	/* FIXME: heightmapsssssss */
-	arr->data.longs = NULL;
-	nbt_free(nbt);
 
+	/* chunks that went out of view before they were sent don't need
+	 * sending anymore, but they still get unloaded below so their
+	 * player counts go back down */
+	chunk_queue_retain(&conn->chunk_queue, new_view);
 	struct unload_chunk unload_packet;
 	VIEW_FOREACH(old_view, view_x, view_z)
 	{
@@ -587,7 +1373,7 @@ int server_update_view(struct conn *conn, struct world *world)
 			world_chunk_dec_players(world, view_x, view_z);
 			unload_packet.chunk_x = view_x;
 			unload_packet.chunk_z = view_z;
-			err =
+			struct protocol_do_err err =
 			    PROTOCOL_WRITE(unload_chunk, conn, &unload_packet);
 			if (err.err_type != PROTOCOL_DO_ERR_SUCCESS) {
 				fprintf(stderr,
@@ -595,6 +1381,103 @@ int server_update_view(struct conn *conn, struct world *world)
 			}
 		}
 	}
-	conn->requesting_chunks = false;
 	return 0;
 }
+
+/* FIXME: once again, the errors suck. there needs to be a giant combined error
+ *        type or something */
+int server_update_view(struct conn *conn, struct world *world)
+{
+	watchdog_note_conn(conn->sfd);
+	struct view current = player_view(world_entities(world), conn);
+	int new_chunk_x = current.x;
+	int new_chunk_z = current.z;
+	conn->requesting_chunks = false;
+	/* crossed a border and came straight back in the same tick */
+	if (new_chunk_x == conn->old_chunk_x
+	    && new_chunk_z == conn->old_chunk_z)
+		return 0;
+
+	struct update_view_position view_pos;
+	view_pos.chunk_x = new_chunk_x;
+	view_pos.chunk_z = new_chunk_z;
+	struct protocol_do_err err =
+	    PROTOCOL_WRITE(update_view_position, conn, &view_pos);
+	if (err.err_type != PROTOCOL_DO_ERR_SUCCESS) {
+		fprintf(stderr,
+			"failed to write update_view_position packet :(\n");
+		return -1;
+	}
+
+	struct view old_view = {
+		.x = conn->old_chunk_x,
+		.z = conn->old_chunk_z,
+		.size = conn->view_distance,
+	};
+	struct view new_view = {
+		.x = new_chunk_x,
+		.z = new_chunk_z,
+		.size = conn->view_distance,
+	};
+	return move_view(conn, world, old_view, new_view);
+}
+
+/* grows or shrinks a connection's view by one chunk towards target */
+static void step_view_distance(struct conn *conn, struct world *world,
+			       int target)
+{
+	struct view old_view = player_view(world_entities(world), conn);
+	struct view new_view = old_view;
+	new_view.size += target > old_view.size ? 1 : -1;
+
+	struct update_view_distance packet = { .view_distance = new_view.size };
+	struct protocol_do_err err =
+	    PROTOCOL_WRITE(update_view_distance, conn, &packet);
+	if (err.err_type != PROTOCOL_DO_ERR_SUCCESS) {
+		fprintf(stderr, "failed to write update_view_distance :(\n");
+		return;
+	}
+	if (move_view(conn, world, old_view, new_view) == 0)
+		conn->view_distance = new_view.size;
+}
+
+void server_adjust_view_distances(struct vector *connections,
+				  struct world *world, long tick_nsec)
+{
+	size_t bytes_per_tick = 0;
+	for (size_t i = 0; i < connections->len; ++i)
+		bytes_per_tick +=
+		    VECTOR_AT(connections, struct conn *, i)->drain_rate;
+
+	const int max_cut = (int) server_properties.view_distance
+			    - VIEW_DISTANCE_MIN;
+	if (view_load.cooldown > 0)
+		--view_load.cooldown;
+	if (tick_nsec > VIEW_SHRINK_TICK_NSEC
+	    || bytes_per_tick > VIEW_SHRINK_BYTES_PER_TICK) {
+		view_load.quiet_ticks = 0;
+		if (view_load.cooldown == 0 && view_load.cut < max_cut) {
+			/* only the start and end of a cut get logged, not
+			 * every step in between */
+			if (view_load.cut++ == 0)
+				fprintf(stderr, "server's struggling, cutting "
+						"view distances\n");
+			view_load.cooldown = VIEW_SHRINK_COOLDOWN_TICKS;
+		}
+	} else if (tick_nsec < VIEW_GROW_TICK_NSEC && view_load.cut > 0
+		   && ++view_load.quiet_ticks >= VIEW_GROW_AFTER_TICKS) {
+		view_load.quiet_ticks = 0;
+		if (--view_load.cut == 0)
+			fprintf(stderr, "server's caught up, view distances "
+					"are back to normal\n");
+	}
+
+	for (size_t i = 0; i < connections->len; ++i) {
+		struct conn *conn = VECTOR_AT(connections, struct conn *, i);
+		int target = target_view_distance(conn);
+		/* a ring of chunks at a time, so the sends and unloads are
+		 * spread out instead of happening all at once */
+		if (target != conn->view_distance && !conn->requesting_chunks)
+			step_view_distance(conn, world, target);
+	}
+}
@@ -6,18 +6,66 @@
 #include "login.h"
 #include "packet.h"
 #include "protocol.h"
+#include "queue.h"
+#include "vector.h"
 #include "world.h"
 
 #include <stdint.h>
 
 #include <openssl/evp.h>
 
+/* totals across every connection since startup, for keeping an eye on
+ * clients that send too much */
+struct rate_limit_stats {
+	uint64_t packets_in;
+	uint64_t bytes_in;
+	/* ticks a connection ran out of tokens with more left to read, summed
+	 * over every connection */
+	uint64_t throttled_ticks;
+	uint64_t kicks;
+};
+
+extern struct rate_limit_stats rate_limit_stats;
+
 struct conn *server_accept_connection(int sfd, struct packet *, struct world *,
 				      struct login_ctx *);
+/* Reads and acts on what the client's sent, as much as its rate limit allows.
+ * Returns 1 if it's still connected, or 0 or -1 if it should be dropped */
 int server_play(struct conn *, struct world *);
-struct protocol_do_err server_send_messages(struct list *connections,
-					    struct list *messages);
+/* Every so often, prints how much everyone's been sending if anyone's been
+ * throttled by the rate limit since the last time */
+void server_report_traffic(struct vector *connections);
+/* Puts off dropping the client for not answering keep alives */
+void server_keep_alive_answered(struct conn *, struct world *);
+/* Puts off kicking the player for being idle, for when they've actually done
+ * something. Does nothing if player-idle-timeout is 0 */
+void server_player_active(struct conn *, struct world *);
+/* Sends each message to whoever it's meant for, see enum message_scope.
+ * Nearby messages are only looked up in the world's interest grid. */
+struct protocol_do_err server_send_messages(struct vector *connections,
+					    struct world *,
+					    struct queue *messages);
 /* Load new chunks and unload old ones for the given connection */
 int server_update_view(struct conn *, struct world *);
+/* Cuts everyone's view distance when the server's overloaded and gives it
+ * back once things calm down, based on how long the last tick took and how
+ * much is being sent. Also applies view distance changes from the clients. */
+void server_adjust_view_distances(struct vector *connections, struct world *,
+				  long tick_nsec);
+/* Sends everyone how the players they can see have moved since last tick,
+ * one packet per player however many position updates came in, and spawns
+ * and destroys players as they come into and go out of range */
+void server_replicate_players(struct world *);
+/* Queue chunks that have finished generating for everyone that can see them */
+void server_send_generated(struct world *);
+/* Start loading the chunks players are heading towards, going by how fast
+ * they've been moving, so they're ready by the time they're in view */
+void server_prefetch_chunks(struct world *);
+/* Send everyone the queued chunks nearest to them, as many as their
+ * connections can take this tick */
+void server_send_chunks(struct vector *connections, struct world *);
+/* Relight whatever's changed and send the new light to everyone that can see
+ * it */
+void server_update_light(struct world *);
 
 #endif
@@ -0,0 +1,121 @@
+#include "blocks.h"
+#include "chunk_index.h"
+#include "strutil.h"
+#include "world.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BLOCKS_PATH "gamedata/blocks.json"
+
+/* an uncompressed level.dat with just enough in it for world generation,
+ * DataVersion 2230 and a RandomSeed of 1 */
+static const uint8_t level_dat[] = {
+	0x0a, 0x00, 0x00,
+	0x0a, 0x00, 0x04, 'D', 'a', 't', 'a',
+	0x03, 0x00, 0x0b, 'D', 'a', 't', 'a', 'V', 'e', 'r', 's', 'i', 'o',
+	'n', 0x00, 0x00, 0x08, 0xb6,
+	0x04, 0x00, 0x0a, 'R', 'a', 'n', 'd', 'o', 'm', 'S', 'e', 'e', 'd',
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+	0x00,
+	0x00,
+};
+
+/* a world in a new temporary directory with no regions in it, so every
+ * chunk gets generated */
+static struct world *temp_world(char *dir)
+{
+	assert(mkdtemp(dir) != NULL);
+	char *path;
+	assert(asprintf(&path, "%s/level.dat", dir) >= 0);
+	FILE *f = fopen(path, "w");
+	assert(f != NULL);
+	assert(fwrite(level_dat, 1, sizeof(level_dat), f) == sizeof(level_dat));
+	fclose(f);
+	free(path);
+
+	struct hashmap *block_table = create_block_table(BLOCKS_PATH);
+	assert(block_table != NULL);
+	struct world *w = world_new(strdup(dir), block_table);
+	assert(world_load_level_data(w) == 0);
+	return w;
+}
+
+static void remove_temp_world(const char *dir)
+{
+	char *path;
+	assert(asprintf(&path, "%s/level.dat", dir) >= 0);
+	unlink(path);
+	free(path);
+	rmdir(dir);
+}
+
+void test_prefetch_comes_into_view()
+{
+	char dir[] = "/tmp/chowder-tests-XXXXXX";
+	struct world *w = temp_world(dir);
+
+	// back the pool up, so the last prefetch is still queued when the
+	// player gets there
+	for (int i = 0; i < 127; ++i)
+		world_prefetch_chunk(w, 64 + i % 16, 64 + i / 16);
+	world_prefetch_chunk(w, 0, 0);
+	world_update_background(w);
+
+	// the player's view moves over it, and nobody prefetches it anymore
+	assert(world_load_chunks(w, 0, 0, 0) == ANVIL_OK);
+	world_update_background(w);
+
+	bool arrived = false;
+	for (int tries = 0; !arrived && tries < 10000; ++tries) {
+		int c_x, c_z;
+		struct chunk *c = world_take_generated(w, &c_x, &c_z);
+		if (c == NULL)
+			nanosleep(&(struct timespec){ .tv_nsec = 1000000 },
+				  NULL);
+		else if (c_x == 0 && c_z == 0)
+			arrived = true;
+	}
+	assert(arrived);
+	assert(world_chunk_at(w, 0, 0) != NULL);
+
+	world_free(w);
+	remove_temp_world(dir);
+}
+
+void test_unreadable_region()
+{
+	char dir[] = "/tmp/chowder-tests-XXXXXX";
+	assert(mkdtemp(dir) != NULL);
+	char *region_dir, *region_path;
+	assert(asprintf(&region_dir, "%s/region", dir) >= 0);
+	assert(asprintf(&region_path, "%s/r.0.0.mca", region_dir) >= 0);
+	// a directory opens fine, but its header can't be read
+	assert(mkdir(region_dir, 0755) == 0 && mkdir(region_path, 0755) == 0);
+
+	struct chunk_index *index = chunk_index_new(dir, 1);
+	assert(index != NULL);
+	assert(chunk_index_region_len(index, 0, 0) == -1);
+	assert(chunk_index_has(index, 5, 7));
+	// regions without a file are still empty
+	assert(chunk_index_region_len(index, 1, 0) == 0);
+	assert(!chunk_index_has(index, 32, 0));
+	chunk_index_free(index);
+
+	rmdir(region_path);
+	rmdir(region_dir);
+	rmdir(dir);
+	free(region_path);
+	free(region_dir);
+}
+
+int main()
+{
+	test_prefetch_comes_into_view();
+	test_unreadable_region();
+}
@@ -0,0 +1,112 @@
+#include "tick.h"
+
+#include "watchdog.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <time.h>
+
+/* a minute's worth */
+#define TICK_REPORT_TICKS 1200
+
+static const char *phase_names[TICK_PHASES_LEN] = {
+	[TICK_NETWORK_IN] = "network in",
+	[TICK_ACT] = "act",
+	[TICK_WORLD] = "world",
+	[TICK_BROADCAST] = "broadcast",
+	[TICK_NETWORK_OUT] = "network out",
+};
+
+const char *tick_phase_name(enum tick_phase phase)
+{
+	return phase_names[phase];
+}
+
+static int64_t now_nsec()
+{
+	struct timespec now;
+	if (clock_gettime(CLOCK_MONOTONIC, &now) < 0) {
+		perror("clock_gettime");
+		return 0;
+	}
+	return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+int tick_clock_init(struct tick_clock *tc)
+{
+	*tc = (struct tick_clock){ 0 };
+	tc->deadline = now_nsec();
+	return tc->deadline == 0 ? -1 : 0;
+}
+
+void tick_begin(struct tick_clock *tc)
+{
+	tc->tick_start = now_nsec();
+	tc->phase_start = tc->tick_start;
+	for (int i = 0; i < TICK_PHASES_LEN; ++i)
+		tc->phase_this_tick[i] = 0;
+	watchdog_tick_begin(tc->tick_start);
+	watchdog_phase_begin(TICK_NETWORK_IN);
+}
+
+void tick_phase_end(struct tick_clock *tc, enum tick_phase phase)
+{
+	int64_t now = now_nsec();
+	tc->phase_this_tick[phase] += now - tc->phase_start;
+	tc->phase_start = now;
+	if (phase + 1 < TICK_PHASES_LEN)
+		watchdog_phase_begin(phase + 1);
+}
+
+static void report(struct tick_clock *tc)
+{
+	if (tc->overran > 0) {
+		printf("WARN: %u of the last %u ticks ran over, %u dropped\n",
+		       tc->overran, tc->ticks, tc->dropped);
+		for (int i = 0; i < TICK_PHASES_LEN; ++i) {
+			printf("  %-12s avg %6.2fms max %6.2fms\n",
+			       phase_names[i],
+			       tc->phase_total[i] / 1e6 / tc->ticks,
+			       tc->phase_max[i] / 1e6);
+		}
+	}
+	tc->ticks = 0;
+	tc->overran = 0;
+	tc->dropped = 0;
+	for (int i = 0; i < TICK_PHASES_LEN; ++i) {
+		tc->phase_total[i] = 0;
+		tc->phase_max[i] = 0;
+	}
+}
+
+void tick_end(struct tick_clock *tc)
+{
+	watchdog_tick_end();
+	int64_t now = now_nsec();
+	tc->last_tick_nsec = now - tc->tick_start;
+	for (int i = 0; i < TICK_PHASES_LEN; ++i) {
+		tc->phase_total[i] += tc->phase_this_tick[i];
+		if (tc->phase_this_tick[i] > tc->phase_max[i])
+			tc->phase_max[i] = tc->phase_this_tick[i];
+	}
+	if (tc->last_tick_nsec > TICK_LEN_NSEC)
+		++tc->overran;
+	if (++tc->ticks == TICK_REPORT_TICKS)
+		report(tc);
+
+	tc->deadline += TICK_LEN_NSEC;
+	if (now - tc->deadline > TICK_CATCH_UP_MAX * TICK_LEN_NSEC) {
+		/* too far behind to catch up, so start over from now */
+		tc->dropped += (now - tc->deadline) / TICK_LEN_NSEC;
+		tc->deadline = now;
+		return;
+	}
+	struct timespec deadline = {
+		.tv_sec = tc->deadline / 1000000000L,
+		.tv_nsec = tc->deadline % 1000000000L,
+	};
+	/* it returns straight away if the deadline's already passed */
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL)
+	       == EINTR)
+		;
+}
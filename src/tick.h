@@ -0,0 +1,62 @@
+/* Keeps ticks on a fixed 50ms grid, and keeps track of where the time in
+ * each one goes.
+ *
+ * Tick deadlines are absolute, so time spent working doesn't push every tick
+ * after it back. A tick that overruns makes the next ones start straight
+ * away until the server's caught up, but only up to TICK_CATCH_UP_MAX ticks
+ * behind; past that the missed ticks are dropped rather than run
+ * back-to-back. */
+#ifndef CHOWDER_TICK_H
+#define CHOWDER_TICK_H
+
+#include <stdint.h>
+
+#define TICK_LEN_NSEC	  50000000L
+#define TICK_CATCH_UP_MAX 20
+
+/* the parts of a tick, in the order they happen */
+enum tick_phase {
+	/* accepting connections, reading what clients sent and acting on
+	 * it */
+	TICK_NETWORK_IN,
+	/* moving views for players that crossed chunk borders */
+	TICK_ACT,
+	/* loading, generating and lighting chunks */
+	TICK_WORLD,
+	/* movement and messages going out to other players */
+	TICK_BROADCAST,
+	/* chunks going out */
+	TICK_NETWORK_OUT,
+	TICK_PHASES_LEN,
+};
+
+struct tick_clock {
+	/* all in CLOCK_MONOTONIC nanoseconds */
+	int64_t deadline;
+	int64_t tick_start;
+	int64_t phase_start;
+	/* how long the last tick's work took, not counting the wait */
+	int64_t last_tick_nsec;
+
+	/* since the last report */
+	unsigned ticks;
+	unsigned overran;
+	unsigned dropped;
+	int64_t phase_total[TICK_PHASES_LEN];
+	int64_t phase_max[TICK_PHASES_LEN];
+	int64_t phase_this_tick[TICK_PHASES_LEN];
+};
+
+const char *tick_phase_name(enum tick_phase);
+
+/* returns 0 on success, or -1 if the clock can't be read */
+int tick_clock_init(struct tick_clock *);
+void tick_begin(struct tick_clock *);
+/* marks the end of a phase, everything since the last one ended (or the
+ * tick began) is counted towards it */
+void tick_phase_end(struct tick_clock *, enum tick_phase);
+/* waits for the next tick's deadline, if it hasn't already passed. prints
+ * where the time went every so often when ticks have been overrunning */
+void tick_end(struct tick_clock *);
+
+#endif // CHOWDER_TICK_H
@@ -0,0 +1,137 @@
+#include "timer_wheel.h"
+
+#include <stdlib.h>
+
+#define SLOT_BITS 6
+#define SLOTS	  (1 << SLOT_BITS)
+#define SLOT_MASK (SLOTS - 1)
+#define LEVELS	  4
+/* about 9 days. timers further off than this get put as far off as they can
+ * go, and pushed back again when they get there */
+#define MAX_TICKS ((1ull << (SLOT_BITS * LEVELS)) - 1)
+
+struct timer_wheel {
+	uint64_t now;
+	/* each slot is the head of a circular list. level 0 has a slot per
+	 * tick, and every level up has a slot per whole slot of the level
+	 * below it */
+	struct timer slots[LEVELS][SLOTS];
+};
+
+static void unlink_timer(struct timer *t)
+{
+	t->prev->next = t->next;
+	t->next->prev = t->prev;
+	t->next = NULL;
+	t->prev = NULL;
+}
+
+static void insert(struct timer_wheel *w, struct timer *t)
+{
+	uint64_t at = t->expires - w->now > MAX_TICKS ? w->now + MAX_TICKS
+						     : t->expires;
+	int level = 0;
+	while (level < LEVELS - 1
+	       && at - w->now >= 1ull << (SLOT_BITS * (level + 1)))
+		++level;
+	struct timer *slot =
+	    &w->slots[level][(at >> (SLOT_BITS * level)) & SLOT_MASK];
+	t->next = slot;
+	t->prev = slot->prev;
+	slot->prev->next = t;
+	slot->prev = t;
+}
+
+/* puts everything in a level's current slot back in, which moves it down a
+ * level or more now that it's closer */
+static void cascade(struct timer_wheel *w, int level)
+{
+	struct timer *slot =
+	    &w->slots[level][(w->now >> (SLOT_BITS * level)) & SLOT_MASK];
+	if (slot->next == slot)
+		return;
+	/* timers pushed back to MAX_TICKS can land right back in the same
+	 * slot, so it's emptied first */
+	struct timer pending = { .next = slot->next, .prev = slot->prev };
+	pending.next->prev = &pending;
+	pending.prev->next = &pending;
+	slot->next = slot;
+	slot->prev = slot;
+	while (pending.next != &pending) {
+		struct timer *t = pending.next;
+		unlink_timer(t);
+		insert(w, t);
+	}
+}
+
+struct timer_wheel *timer_wheel_new()
+{
+	struct timer_wheel *w = malloc(sizeof(struct timer_wheel));
+	if (w == NULL)
+		return NULL;
+	w->now = 0;
+	for (int level = 0; level < LEVELS; ++level) {
+		for (int i = 0; i < SLOTS; ++i) {
+			w->slots[level][i].next = &w->slots[level][i];
+			w->slots[level][i].prev = &w->slots[level][i];
+		}
+	}
+	return w;
+}
+
+void timer_wheel_free(struct timer_wheel *w)
+{
+	for (int level = 0; level < LEVELS; ++level) {
+		for (int i = 0; i < SLOTS; ++i) {
+			struct timer *slot = &w->slots[level][i];
+			while (slot->next != slot)
+				unlink_timer(slot->next);
+		}
+	}
+	free(w);
+}
+
+uint64_t timer_wheel_now(const struct timer_wheel *w)
+{
+	return w->now;
+}
+
+void timer_wheel_advance(struct timer_wheel *w)
+{
+	++w->now;
+	/* a level's slot comes round every time the levels below it have
+	 * gone all the way round */
+	for (int level = 1; level < LEVELS
+			    && (w->now >> (SLOT_BITS * (level - 1)) & SLOT_MASK)
+				   == 0;
+	     ++level)
+		cascade(w, level);
+
+	struct timer *slot = &w->slots[0][w->now & SLOT_MASK];
+	while (slot->next != slot) {
+		struct timer *t = slot->next;
+		unlink_timer(t);
+		t->fire(w, t->data);
+	}
+}
+
+void timer_schedule(struct timer_wheel *w, struct timer *t, uint64_t ticks,
+		    timer_func fire, void *data)
+{
+	timer_cancel(t);
+	t->expires = w->now + (ticks > 0 ? ticks : 1);
+	t->fire = fire;
+	t->data = data;
+	insert(w, t);
+}
+
+void timer_cancel(struct timer *t)
+{
+	if (t->next != NULL)
+		unlink_timer(t);
+}
+
+bool timer_pending(const struct timer *t)
+{
+	return t->next != NULL;
+}
@@ -0,0 +1,49 @@
+/* Timers that go off a number of ticks from now, for anything that has to
+ * happen later: keep alives, timeouts and so on. They're kept in a
+ * hierarchical timer wheel, so advancing it a tick only touches the timers
+ * that are due, plus once every 64 ticks a slot's worth of timers that get
+ * moved closer to going off. Nothing has to look at every connection to find
+ * out nothing's due yet.
+ *
+ * A timer lives in whatever it's for, so scheduling one never allocates. A
+ * zeroed struct timer isn't scheduled, and a timer has to be cancelled
+ * before the memory it's in is freed. */
+#ifndef CHOWDER_TIMER_WHEEL_H
+#define CHOWDER_TIMER_WHEEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct timer_wheel;
+
+/* gets the wheel it went off in, for scheduling itself again */
+typedef void (*timer_func)(struct timer_wheel *, void *data);
+
+struct timer {
+	/* NULL when it isn't scheduled */
+	struct timer *next;
+	struct timer *prev;
+	uint64_t expires;
+	timer_func fire;
+	void *data;
+};
+
+struct timer_wheel *timer_wheel_new();
+/* cancels whatever's still scheduled */
+void timer_wheel_free(struct timer_wheel *);
+
+/* how many times it's been advanced */
+uint64_t timer_wheel_now(const struct timer_wheel *);
+/* moves on a tick, and calls every timer that's due. they're cancelled
+ * before they're called, so they can schedule themselves again */
+void timer_wheel_advance(struct timer_wheel *);
+
+/* calls fire with data after the given number of ticks, at least 1.
+ * scheduling a timer that's already scheduled moves it */
+void timer_schedule(struct timer_wheel *, struct timer *, uint64_t ticks,
+		    timer_func fire, void *data);
+/* does nothing if it isn't scheduled */
+void timer_cancel(struct timer *);
+bool timer_pending(const struct timer *);
+
+#endif // CHOWDER_TIMER_WHEEL_H
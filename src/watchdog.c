@@ -0,0 +1,245 @@
+#include "watchdog.h"
+
+#include "config.h"
+
+#include <errno.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define POLL_NSEC      100000000L
+#define BACKTRACE_MAX  64
+/* how long to wait for the main thread to write its backtrace. if it's
+ * stuck somewhere with signals blocked it never will */
+#define BACKTRACE_WAIT_MSEC 1000
+
+#define NO_PHASE TICK_PHASES_LEN
+
+enum severity {
+	SEVERITY_NONE,
+	SEVERITY_SOFT,
+	SEVERITY_HARD,
+};
+
+static struct {
+	pthread_t thread;
+	pthread_t main_thread;
+	atomic_bool running;
+
+	/* 0 between ticks */
+	atomic_int_least64_t tick_start;
+	atomic_uint_least64_t tick;
+	atomic_int phase;
+	atomic_int conn;
+	atomic_bool has_chunk;
+	atomic_int chunk_x;
+	atomic_int chunk_z;
+
+	/* the report the main thread writes its backtrace to, and whether
+	 * it's done so yet */
+	atomic_int backtrace_fd;
+	atomic_bool backtrace_done;
+} watchdog = { .conn = -1, .phase = NO_PHASE, .backtrace_fd = -1 };
+
+static const char *severity_names[] = {
+	[SEVERITY_NONE] = "none",
+	[SEVERITY_SOFT] = "soft",
+	[SEVERITY_HARD] = "hard",
+};
+
+static int64_t now_nsec()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+/* runs on the main thread, wherever it happened to be. see watchdog.h for
+ * why backtrace() in here is only mostly safe */
+static void backtrace_handler(int signum)
+{
+	(void) signum;
+	int saved_errno = errno;
+	int fd = atomic_load(&watchdog.backtrace_fd);
+	if (fd >= 0) {
+		void *frames[BACKTRACE_MAX];
+		int len = backtrace(frames, BACKTRACE_MAX);
+		backtrace_symbols_fd(frames, len, fd);
+	}
+	atomic_store(&watchdog.backtrace_done, true);
+	errno = saved_errno;
+}
+
+static void wait_for_backtrace()
+{
+	for (int waited = 0; waited < BACKTRACE_WAIT_MSEC; waited += 10) {
+		if (atomic_load(&watchdog.backtrace_done))
+			return;
+		nanosleep(&(struct timespec){ .tv_nsec = 10000000 }, NULL);
+	}
+}
+
+static void report(enum severity severity, int64_t tick_nsec)
+{
+	char date[32];
+	char path[64];
+	time_t now = time(NULL);
+	struct tm tm;
+	strftime(date, sizeof(date), "%Y-%m-%d_%H.%M.%S",
+		 localtime_r(&now, &tm));
+	snprintf(path, sizeof(path), "watchdog-%s-%s.txt", date,
+		 severity_names[severity]);
+	FILE *f = fopen(path, "w");
+	if (f == NULL) {
+		fprintf(stderr, "watchdog: can't open \"%s\": %s\n", path,
+			strerror(errno));
+		f = stderr;
+	}
+
+	int phase = atomic_load(&watchdog.phase);
+	int conn = atomic_load(&watchdog.conn);
+	fprintf(f, "severity: %s\n", severity_names[severity]);
+	fprintf(f, "tick: %llu\n",
+		(unsigned long long) atomic_load(&watchdog.tick));
+	fprintf(f, "tick time: %lldms\n", (long long) tick_nsec / 1000000);
+	fprintf(f, "max tick time: %ums\n", server_properties.max_tick_time);
+	fprintf(f, "phase: %s\n",
+		phase == NO_PHASE ? "none" : tick_phase_name(phase));
+	if (conn >= 0)
+		fprintf(f, "connection: %d\n", conn);
+	else
+		fprintf(f, "connection: none\n");
+	if (atomic_load(&watchdog.has_chunk)) {
+		fprintf(f, "chunk: %d,%d\n", atomic_load(&watchdog.chunk_x),
+			atomic_load(&watchdog.chunk_z));
+	} else {
+		fprintf(f, "chunk: none\n");
+	}
+	fprintf(f, "backtrace:\n");
+	fflush(f);
+
+	atomic_store(&watchdog.backtrace_done, false);
+	atomic_store(&watchdog.backtrace_fd, fileno(f));
+	if (pthread_kill(watchdog.main_thread, SIGUSR1) == 0)
+		wait_for_backtrace();
+	atomic_store(&watchdog.backtrace_fd, -1);
+	if (!atomic_load(&watchdog.backtrace_done))
+		fprintf(f, "  (the main thread didn't answer)\n");
+
+	if (f != stderr) {
+		fclose(f);
+		fprintf(stderr, "WARN: tick %llu has taken %lldms, see %s\n",
+			(unsigned long long) atomic_load(&watchdog.tick),
+			(long long) tick_nsec / 1000000, path);
+	}
+}
+
+static void *watch(void *data)
+{
+	(void) data;
+	uint32_t max_tick_time = server_properties.max_tick_time;
+	bool hard = max_tick_time != 0 && max_tick_time != UINT32_MAX;
+	int64_t soft_nsec = WATCHDOG_SOFT_MSEC * 1000000L;
+	int64_t hard_nsec = max_tick_time * 1000000L;
+	if (hard && hard_nsec < soft_nsec)
+		soft_nsec = hard_nsec;
+
+	uint64_t reported_tick = 0;
+	enum severity reported = SEVERITY_NONE;
+	while (atomic_load(&watchdog.running)) {
+		nanosleep(&(struct timespec){ .tv_nsec = POLL_NSEC }, NULL);
+		int64_t start = atomic_load(&watchdog.tick_start);
+		uint64_t tick = atomic_load(&watchdog.tick);
+		if (start == 0)
+			continue;
+		if (tick != reported_tick) {
+			reported_tick = tick;
+			reported = SEVERITY_NONE;
+		}
+
+		int64_t tick_nsec = now_nsec() - start;
+		if (hard && tick_nsec > hard_nsec) {
+			report(SEVERITY_HARD, tick_nsec);
+			fprintf(stderr, "a single tick took over %ums, "
+					"shutting down :(\n",
+				max_tick_time);
+			abort();
+		} else if (tick_nsec > soft_nsec && reported < SEVERITY_SOFT) {
+			report(SEVERITY_SOFT, tick_nsec);
+			reported = SEVERITY_SOFT;
+		}
+	}
+	return NULL;
+}
+
+int watchdog_start()
+{
+	watchdog.main_thread = pthread_self();
+	/* the first backtrace() loads libgcc, which isn't something to be
+	 * doing in a signal handler */
+	void *frame;
+	backtrace(&frame, 1);
+
+	struct sigaction act = { 0 };
+	act.sa_handler = backtrace_handler;
+	act.sa_flags = SA_RESTART;
+	if (sigaction(SIGUSR1, &act, NULL) < 0) {
+		perror("sigaction");
+		return -1;
+	}
+	atomic_store(&watchdog.running, true);
+	int err = pthread_create(&watchdog.thread, NULL, watch, NULL);
+	if (err != 0) {
+		fprintf(stderr, "failed to start the watchdog: %s\n",
+			strerror(err));
+		atomic_store(&watchdog.running, false);
+		return -1;
+	}
+	return 0;
+}
+
+void watchdog_stop()
+{
+	if (!atomic_exchange(&watchdog.running, false))
+		return;
+	pthread_join(watchdog.thread, NULL);
+}
+
+void watchdog_tick_begin(int64_t start)
+{
+	atomic_fetch_add(&watchdog.tick, 1);
+	atomic_store(&watchdog.tick_start, start);
+}
+
+void watchdog_phase_begin(enum tick_phase phase)
+{
+	atomic_store(&watchdog.phase, phase);
+	atomic_store(&watchdog.conn, -1);
+	atomic_store(&watchdog.has_chunk, false);
+}
+
+void watchdog_tick_end()
+{
+	atomic_store(&watchdog.tick_start, 0);
+	watchdog_phase_begin(NO_PHASE);
+}
+
+void watchdog_note_conn(int sfd)
+{
+	atomic_store_explicit(&watchdog.conn, sfd, memory_order_relaxed);
+}
+
+void watchdog_note_chunk(int c_x, int c_z)
+{
+	atomic_store_explicit(&watchdog.chunk_x, c_x, memory_order_relaxed);
+	atomic_store_explicit(&watchdog.chunk_z, c_z, memory_order_relaxed);
+	atomic_store_explicit(&watchdog.has_chunk, true, memory_order_relaxed);
+}
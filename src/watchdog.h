@@ -0,0 +1,42 @@
+/* A thread that keeps an eye on the main thread's ticks, and writes a report
+ * when one's taking too long: what phase it was in, which connection and
+ * chunk it was last working on, and a backtrace of where it is right now.
+ *
+ * A tick going over WATCHDOG_SOFT_MSEC gets a report and carries on. One
+ * going over max-tick-time gets a report and then takes the server down,
+ * since it's probably never coming back. A max-tick-time of 0 or -1 turns
+ * the second part off.
+ *
+ * The backtrace is taken by the main thread itself, in a SIGUSR1 handler.
+ * backtrace() isn't async-signal-safe: the first call loads libgcc, which
+ * is why watchdog_start() makes one up front, but unwinding can still take
+ * locks in the dynamic loader. A main thread that's stuck holding one of
+ * those (in dlopen(), say) would deadlock in the handler, and then the
+ * report just says it didn't answer. */
+#ifndef CHOWDER_WATCHDOG_H
+#define CHOWDER_WATCHDOG_H
+
+#include "tick.h"
+
+#include <stdint.h>
+
+#define WATCHDOG_SOFT_MSEC 1000
+
+/* has to be called from the main thread, which is the one that gets
+ * watched. returns 0 on success, or -1 if the thread couldn't be started */
+int watchdog_start();
+void watchdog_stop();
+
+/* these are called by the tick clock. start is in CLOCK_MONOTONIC
+ * nanoseconds */
+void watchdog_tick_begin(int64_t start);
+void watchdog_phase_begin(enum tick_phase);
+void watchdog_tick_end();
+
+/* what the main thread's working on, only the last one of each is kept, and
+ * they're forgotten at the end of every phase. sfd is the connection's
+ * socket, which is what shows up in the report */
+void watchdog_note_conn(int sfd);
+void watchdog_note_chunk(int c_x, int c_z);
+
+#endif // CHOWDER_WATCHDOG_H
@@ -1,24 +1,91 @@
 #include "world.h"
 
 #include "anvil.h"
+#include "blocks.h"
+#include "chunk_index.h"
+#include "lighting.h"
 #include "mc.h"
 #include "nbt.h"
 #include "nbt_extra.h"
+#include "pool.h"
 #include "region.h"
 #include "strutil.h"
 #include "view.h"
+#include "watchdog.h"
+#include "worldgen.h"
 
 #include <assert.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+/* at most this many chunks get prefetched at once */
+#define PREFETCH_MAX_PENDING 128
+/* how many ticks a chunk that was loaded in the background stays loaded if
+ * nobody ends up looking at it */
+#define IDLE_CHUNK_TICKS 200
+/* region files that haven't been used in a while get closed once there are
+ * more than this many open */
+#define REGION_FILES_MAX 64
+
+enum job_state {
+	JOB_QUEUED,
+	JOB_STARTED,
+	JOB_CANCELLED,
+};
+
+struct gen_job {
+	const struct worldgen *gen;
+	int c_x;
+	int c_z;
+	struct chunk *chunk;
+
+	/* prefetches of chunks that might be saved try loading them before
+	 * generating them */
+	bool try_load;
+	const char *world_path;
+	struct hashmap *block_table;
+	/* the last tick a player wanted the chunk */
+	unsigned wanted_tick;
+	/* only a job that hasn't started can be cancelled */
+	atomic_int state;
+};
+
+/* a chunk that was loaded in the background, and gets unloaded at
+ * expires_tick unless a player can see it by then */
+struct idle_chunk {
+	int c_x;
+	int c_z;
+	unsigned expires_tick;
+};
+
 struct world {
 	char *world_path;
 	struct nbt *level_data;
 	struct hashmap *block_table;
 	struct hashmap *regions;
+	struct region_files *region_files;
+	struct lighting *lighting;
+	struct interest_grid *interest;
+	struct entities *entities;
+	struct timer_wheel *timers;
+	/* both NULL if chunks can't be generated */
+	struct worldgen *gen;
+	struct pool *gen_pool;
+	/* NULL if it couldn't be built, in which case any chunk might be
+	 * saved */
+	struct chunk_index *index;
+
+	unsigned tick;
+	/* prefetch jobs that are still queued or running, and haven't been
+	 * cancelled */
+	struct gen_job *prefetching[PREFETCH_MAX_PENDING];
+	int prefetching_len;
+	struct idle_chunk *idle;
+	size_t idle_len;
+	size_t idle_cap;
 };
 
 struct world *world_new(char *world_path, struct hashmap *block_table)
@@ -28,6 +95,19 @@ struct world *world_new(char *world_path, struct hashmap *block_table)
 	w->level_data = NULL;
 	w->block_table = block_table;
 	w->regions = hashmap_new(1);
+	w->region_files = region_files_new(REGION_FILES_MAX);
+	w->lighting = lighting_new();
+	w->interest = interest_grid_new();
+	w->entities = entities_new();
+	w->timers = timer_wheel_new();
+	w->gen = NULL;
+	w->gen_pool = NULL;
+	w->index = NULL;
+	w->tick = 0;
+	w->prefetching_len = 0;
+	w->idle = NULL;
+	w->idle_len = 0;
+	w->idle_cap = 0;
 	return w;
 }
 
@@ -63,6 +143,22 @@ int world_load_level_data(struct world *world)
 	}
 
 	world->level_data = level_data;
+
+	int64_t seed = 0;
+	nbt_get_value(data, TAG_Long, "RandomSeed", &seed);
+	world->gen = worldgen_new(seed, world->block_table);
+	if (world->gen != NULL)
+		world->gen_pool = pool_new(pool_default_threads());
+	if (world->gen_pool == NULL) {
+		fprintf(stderr, "missing chunks won't be generated\n");
+		worldgen_free(world->gen);
+		world->gen = NULL;
+	}
+
+	world->index =
+	    chunk_index_new(world->world_path, pool_default_threads());
+	if (world->index == NULL)
+		fprintf(stderr, "no chunk index, looking for every chunk\n");
 	return 0;
 }
 
@@ -116,6 +212,18 @@ static void world_add_region(struct world *w, struct region *r)
 	hashmap_add(w->regions, region_str, r);
 }
 
+/* regions are only kept around while something in them is loaded or being
+ * generated */
+static void free_region_if_empty(struct world *w, struct region *r)
+{
+	if (!region_is_empty(r))
+		return;
+	char *region_str = region_string(r->x, r->z);
+	hashmap_remove(w->regions, region_str);
+	free(region_str);
+	free_region(r);
+}
+
 struct region *world_region_at(struct world *w, int x, int z)
 {
 	char *region_str = region_string(x, z);
@@ -124,39 +232,189 @@ struct region *world_region_at(struct world *w, int x, int z)
 	return r;
 }
 
+static void generate(void *data)
+{
+	struct gen_job *job = data;
+	int queued = JOB_QUEUED;
+	if (!atomic_compare_exchange_strong(&job->state, &queued, JOB_STARTED))
+		return;
+
+	if (job->try_load) {
+		/* this thread can't share the main thread's region file */
+		struct region *region;
+		enum anvil_err err =
+		    region_open(job->world_path, mc_chunk_to_region(job->c_x),
+				mc_chunk_to_region(job->c_z), &region);
+		if (err == ANVIL_OK) {
+			err = anvil_get_chunk(region, job->block_table,
+					      mc_localized_chunk(job->c_x),
+					      mc_localized_chunk(job->c_z),
+					      &job->chunk);
+			free_region(region);
+		}
+		if (err == ANVIL_OK && !job->chunk->has_heightmap)
+			chunk_compute_heightmap(job->chunk,
+						block_blocks_motion);
+		if (err != ANVIL_CHUNK_MISSING) {
+			if (err != ANVIL_OK)
+				job->chunk = NULL;
+			return;
+		}
+	}
+	job->chunk = worldgen_chunk(job->gen, job->c_x, job->c_z);
+}
+
+static void free_gen_job(void *data)
+{
+	struct gen_job *job = data;
+	if (job->chunk != NULL)
+		free_chunk(job->chunk);
+	free(job);
+}
+
+static struct gen_job *queue_generation(struct world *w,
+					struct region *region, int c_x,
+					int c_z, bool try_load)
+{
+	struct gen_job *job = malloc(sizeof(struct gen_job));
+	if (job == NULL)
+		return NULL;
+	*job = (struct gen_job){
+		.gen = w->gen,
+		.c_x = c_x,
+		.c_z = c_z,
+		.try_load = try_load,
+		.world_path = w->world_path,
+		.block_table = w->block_table,
+		.wanted_tick = w->tick,
+	};
+	atomic_init(&job->state, JOB_QUEUED);
+	if (pool_submit(w->gen_pool, generate, job) < 0) {
+		free(job);
+		return NULL;
+	}
+	region_set_generating(region, mc_localized_chunk(c_x),
+			      mc_localized_chunk(c_z), true);
+	return job;
+}
+
+/* false if the chunk definitely isn't saved, so there's no point trying to
+ * load it */
+static bool maybe_saved(struct world *w, int c_x, int c_z)
+{
+	return w->index == NULL || chunk_index_has(w->index, c_x, c_z);
+}
+
+/* a prefetch that someone can now see has to finish, since nothing will ask
+ * for it again, so it stops being one that can be cancelled */
+static void keep_prefetch(struct world *w, int c_x, int c_z)
+{
+	for (int i = 0; i < w->prefetching_len; ++i) {
+		struct gen_job *job = w->prefetching[i];
+		if (job->c_x == c_x && job->c_z == c_z) {
+			w->prefetching[i] =
+			    w->prefetching[--w->prefetching_len];
+			return;
+		}
+	}
+}
+
+/* returns the region a chunk's in, opening it if it isn't already */
+static struct region *chunk_region(struct world *w, int c_x, int c_z,
+				   enum anvil_err *err)
+{
+	int r_x = mc_chunk_to_region(c_x);
+	int r_z = mc_chunk_to_region(c_z);
+	struct region *region = world_region_at(w, r_x, r_z);
+	*err = ANVIL_OK;
+	if (region == NULL) {
+		*err = region_open(w->world_path, r_x, r_z, &region);
+		if (*err != ANVIL_OK)
+			return NULL;
+		region_files_add(w->region_files, region);
+		world_add_region(w, region);
+	}
+	return region;
+}
+
+/* loads the chunks from (x1,z1) to (x2,z2), which are global chunk
+ * coordinates that all have to be in the same region */
+static enum anvil_err load_region_range(struct world *w, int x1, int z1,
+					int x2, int z2)
+{
+	enum anvil_err err;
+	watchdog_note_chunk(x1, z1);
+	struct region *region = chunk_region(w, x1, z1, &err);
+	if (region == NULL)
+		return err;
+
+	struct anvil_get_chunks_ctx ctx = {
+		.block_table = w->block_table,
+		.cx1 = mc_localized_chunk(x1),
+		.cz1 = mc_localized_chunk(z1),
+		.cx2 = mc_localized_chunk(x2),
+		.cz2 = mc_localized_chunk(z2),
+	};
+	/* FIXME: should one chunk failing to load really cause the whole
+	 *        thing to fail? */
+	if (w->index == NULL
+	    || chunk_index_region_len(w->index, region->x, region->z) != 0)
+		err = anvil_get_chunks(&ctx, region);
+	if (err != ANVIL_OK) {
+		/* a region that was only just opened for this shouldn't stay
+		 * open, or in the LRU, with nothing in it */
+		free_region_if_empty(w, region);
+		return err;
+	}
+
+	for (int c_z = z1; c_z <= z2; ++c_z) {
+		for (int c_x = x1; c_x <= x2; ++c_x) {
+			int lc_x = mc_localized_chunk(c_x);
+			int lc_z = mc_localized_chunk(c_z);
+			struct chunk *c = region_get_chunk(region, lc_x, lc_z);
+			if (c != NULL) {
+				if (!c->has_heightmap)
+					chunk_compute_heightmap(
+					    c, block_blocks_motion);
+			} else if (region_is_generating(region, lc_x, lc_z)) {
+				/* already on its way, as long as it isn't a
+				 * prefetch that gets cancelled */
+				keep_prefetch(w, c_x, c_z);
+			} else if (w->gen != NULL) {
+				/* it'll turn up in world_take_generated() */
+				queue_generation(w, region, c_x, c_z, false);
+			} else {
+				free_region_if_empty(w, region);
+				return ANVIL_CHUNK_MISSING;
+			}
+		}
+	}
+	return ANVIL_OK;
+}
+
 enum anvil_err world_load_chunks(struct world *w, int x, int z,
 				 int view_distance)
 {
 	struct view view = { .x = mc_coord_to_chunk(x),
 			     .z = mc_coord_to_chunk(z),
 			     .size = view_distance };
-	int vx, vz;
-	VIEW_FOREACH(view, vx, vz)
-	{
-		int rx = mc_chunk_to_region(vx);
-		int rz = mc_chunk_to_region(vz);
-		struct region *region = world_region_at(w, rx, rz);
-		if (region == NULL) {
-			enum anvil_err err =
-			    region_open(w->world_path, rx, rz, &region);
-			if (err != ANVIL_OK) {
+	int x1 = view.x - view.size;
+	int z1 = view.z - view.size;
+	int x2 = view.x + view.size;
+	int z2 = view.z + view.size;
+	/* the view gets loaded a region at a time, since that's how
+	 * anvil_get_chunks() can read it in order */
+	for (int r_z = mc_chunk_to_region(z1); r_z <= mc_chunk_to_region(z2);
+	     ++r_z) {
+		for (int r_x = mc_chunk_to_region(x1);
+		     r_x <= mc_chunk_to_region(x2); ++r_x) {
+			enum anvil_err err = load_region_range(
+			    w, x1 > r_x * 32 ? x1 : r_x * 32,
+			    z1 > r_z * 32 ? z1 : r_z * 32,
+			    x2 < r_x * 32 + 31 ? x2 : r_x * 32 + 31,
+			    z2 < r_z * 32 + 31 ? z2 : r_z * 32 + 31);
+			if (err != ANVIL_OK)
 				return err;
-			}
-			world_add_region(w, region);
-		}
-		int lcx = mc_localized_chunk(vx);
-		int lcz = mc_localized_chunk(vz);
-		if (region_get_chunk(region, lcx, lcz) == NULL) {
-			struct chunk *chunk = NULL;
-			enum anvil_err err = anvil_get_chunk(
-			    region, w->block_table, lcx, lcz, &chunk);
-			if (err != ANVIL_OK) {
-				/* FIXME: should one chunk failing to load
-				 *        really cause the whole thing to
-				 *        fail? */
-				return err;
-			}
-			region_set_chunk(region, lcx, lcz, chunk);
 		}
 	}
 	return ANVIL_OK;
@@ -175,7 +433,144 @@ struct chunk *world_chunk_at(struct world *w, int c_x, int c_z)
 	}
 }
 
-void world_chunk_dec_players(struct world *w, int c_x, int c_z)
+static void add_idle_chunk(struct world *w, int c_x, int c_z)
+{
+	if (w->idle_len == w->idle_cap) {
+		size_t cap = w->idle_cap == 0 ? 64 : w->idle_cap * 2;
+		struct idle_chunk *idle =
+		    reallocarray(w->idle, cap, sizeof(struct idle_chunk));
+		if (idle == NULL) {
+			perror("reallocarray");
+			return;
+		}
+		w->idle = idle;
+		w->idle_cap = cap;
+	}
+	w->idle[w->idle_len++] = (struct idle_chunk){
+		.c_x = c_x,
+		.c_z = c_z,
+		.expires_tick = w->tick + IDLE_CHUNK_TICKS,
+	};
+}
+
+struct chunk *world_take_generated(struct world *w, int *c_x, int *c_z)
+{
+	if (w->gen_pool == NULL)
+		return NULL;
+
+	struct gen_job *job;
+	while ((job = pool_take_done(w->gen_pool)) != NULL) {
+		/* cancelled jobs were already forgotten about, and another
+		 * job for the same chunk might be on its way */
+		if (atomic_load(&job->state) == JOB_CANCELLED) {
+			free(job);
+			continue;
+		}
+		for (int i = 0; i < w->prefetching_len; ++i) {
+			if (w->prefetching[i] == job) {
+				w->prefetching[i] =
+				    w->prefetching[--w->prefetching_len];
+				break;
+			}
+		}
+
+		struct region *region =
+		    world_region_at(w, mc_chunk_to_region(job->c_x),
+				    mc_chunk_to_region(job->c_z));
+		int lc_x = mc_localized_chunk(job->c_x);
+		int lc_z = mc_localized_chunk(job->c_z);
+		struct chunk *chunk = job->chunk;
+		*c_x = job->c_x;
+		*c_z = job->c_z;
+		free(job);
+		region_set_generating(region, lc_x, lc_z, false);
+		if (chunk != NULL) {
+			region_set_chunk(region, lc_x, lc_z, chunk);
+			add_idle_chunk(w, *c_x, *c_z);
+			return chunk;
+		}
+		fprintf(stderr, "failed to generate chunk (%d,%d)\n", *c_x,
+			*c_z);
+		free_region_if_empty(w, region);
+	}
+	return NULL;
+}
+
+void world_prefetch_chunk(struct world *w, int c_x, int c_z)
+{
+	if (w->gen_pool == NULL)
+		return;
+	for (int i = 0; i < w->prefetching_len; ++i) {
+		struct gen_job *job = w->prefetching[i];
+		if (job->c_x == c_x && job->c_z == c_z) {
+			job->wanted_tick = w->tick;
+			return;
+		}
+	}
+	if (w->prefetching_len == PREFETCH_MAX_PENDING)
+		return;
+
+	enum anvil_err err;
+	struct region *region = chunk_region(w, c_x, c_z, &err);
+	if (region == NULL)
+		return;
+	int lc_x = mc_localized_chunk(c_x);
+	int lc_z = mc_localized_chunk(c_z);
+	if (region_get_chunk(region, lc_x, lc_z) != NULL
+	    || region_is_generating(region, lc_x, lc_z))
+		return;
+	struct gen_job *job =
+	    queue_generation(w, region, c_x, c_z, maybe_saved(w, c_x, c_z));
+	if (job != NULL)
+		w->prefetching[w->prefetching_len++] = job;
+	else
+		free_region_if_empty(w, region);
+}
+
+void world_update_background(struct world *w)
+{
+	/* prefetches nobody asked for again this tick aren't worth doing
+	 * anymore, unless they've already started */
+	for (int i = 0; i < w->prefetching_len;) {
+		struct gen_job *job = w->prefetching[i];
+		int queued = JOB_QUEUED;
+		if (job->wanted_tick != w->tick
+		    && atomic_compare_exchange_strong(&job->state, &queued,
+						      JOB_CANCELLED)) {
+			struct region *region =
+			    world_region_at(w, mc_chunk_to_region(job->c_x),
+					    mc_chunk_to_region(job->c_z));
+			region_set_generating(region,
+					      mc_localized_chunk(job->c_x),
+					      mc_localized_chunk(job->c_z),
+					      false);
+			free_region_if_empty(w, region);
+			w->prefetching[i] =
+			    w->prefetching[--w->prefetching_len];
+		} else {
+			++i;
+		}
+	}
+
+	for (size_t i = 0; i < w->idle_len;) {
+		struct idle_chunk *idle = &w->idle[i];
+		struct chunk *chunk = world_chunk_at(w, idle->c_x, idle->c_z);
+		if (chunk != NULL && chunk->player_count > 0) {
+			/* someone's using it, so it'll be unloaded once
+			 * they're done with it instead */
+			*idle = w->idle[--w->idle_len];
+		} else if (idle->expires_tick == w->tick) {
+			if (chunk != NULL)
+				world_unload_chunk(w, idle->c_x, idle->c_z);
+			*idle = w->idle[--w->idle_len];
+		} else {
+			++i;
+		}
+	}
+	++w->tick;
+}
+
+void world_unload_chunk(struct world *w, int c_x, int c_z)
 {
 	int r_x = mc_chunk_to_region(c_x);
 	int r_z = mc_chunk_to_region(c_z);
@@ -185,20 +580,59 @@ void world_chunk_dec_players(struct world *w, int c_x, int c_z)
 		int lc_z = mc_localized_chunk(c_z);
 		struct chunk *chunk = region_get_chunk(region, lc_x, lc_z);
 		if (chunk != NULL) {
-			// FIXME: player count is becoming negative???
-			--chunk->player_count;
-			if (chunk->player_count == 0) {
-				region_set_chunk(region, lc_x, lc_z, NULL);
-				free_chunk(chunk);
-			}
+			region_set_chunk(region, lc_x, lc_z, NULL);
+			free_chunk(chunk);
+			free_region_if_empty(w, region);
 		}
 	}
 }
 
+void world_chunk_dec_players(struct world *w, int c_x, int c_z)
+{
+	struct chunk *chunk = world_chunk_at(w, c_x, c_z);
+	if (chunk != NULL) {
+		// FIXME: player count is becoming negative???
+		--chunk->player_count;
+		if (chunk->player_count == 0)
+			world_unload_chunk(w, c_x, c_z);
+	}
+}
+
+struct lighting *world_lighting(struct world *w)
+{
+	return w->lighting;
+}
+
+struct interest_grid *world_interest(struct world *w)
+{
+	return w->interest;
+}
+
+struct entities *world_entities(struct world *w)
+{
+	return w->entities;
+}
+
+struct timer_wheel *world_timers(struct world *w)
+{
+	return w->timers;
+}
+
 void world_free(struct world *w)
 {
+	if (w->gen_pool != NULL)
+		pool_free(w->gen_pool, free_gen_job);
+	worldgen_free(w->gen);
+	if (w->index != NULL)
+		chunk_index_free(w->index);
 	free(w->world_path);
 	nbt_free(w->level_data);
 	hashmap_free(w->block_table, true, free);
 	hashmap_free(w->regions, true, (free_item_func) free_region);
+	region_files_free(w->region_files);
+	lighting_free(w->lighting);
+	interest_grid_free(w->interest);
+	entities_free(w->entities);
+	timer_wheel_free(w->timers);
+	free(w->idle);
 }
@@ -2,8 +2,11 @@
 #define CHOWDER_WORLD_H
 
 #include "anvil.h"
+#include "entities.h"
 #include "hashmap.h"
+#include "interest.h"
 #include "region.h"
+#include "timer_wheel.h"
 
 #include <stdint.h>
 
@@ -15,12 +18,33 @@ int world_load_level_data(struct world *);
 uint64_t world_get_spawn(struct world *);
 /* Takes region x,z coords */
 struct region *world_region_at(struct world *, int x, int z);
-/* Takes a global position */
+/* Takes a global position. Chunks that aren't in the world yet get generated
+ * in the background, see world_take_generated() */
 enum anvil_err world_load_chunks(struct world *, int x, int z,
 				 int view_distance);
+/* returns a chunk that's finished generating since the last call, already
+ * added to the world, or NULL if there aren't any more. Takes global chunk
+ * coordinates */
+struct chunk *world_take_generated(struct world *, int *c_x, int *c_z);
+/* Starts loading a chunk in the background because a player's probably about
+ * to need it, generating it if it's missing. Takes global chunk coordinates.
+ * Prefetches that aren't asked for again every tick get cancelled by
+ * world_update_background() if they haven't started yet. Finished ones come
+ * out of world_take_generated() like generated chunks do. */
+void world_prefetch_chunk(struct world *, int c_x, int c_z);
+/* Cancels stale prefetches, and unloads chunks from world_take_generated()
+ * that nobody's looked at for a while. Call once a tick. */
+void world_update_background(struct world *);
 /* Takes global chunk coordinates */
 struct chunk *world_chunk_at(struct world *, int c_x, int c_z);
+void world_unload_chunk(struct world *, int c_x, int c_z);
 void world_chunk_dec_players(struct world *w, int c_x, int c_z);
+struct lighting *world_lighting(struct world *);
+/* where everyone in the world is, for working out who's near what */
+struct interest_grid *world_interest(struct world *);
+struct entities *world_entities(struct world *);
+/* advanced once a tick, at the start of it */
+struct timer_wheel *world_timers(struct world *);
 
 void world_free(struct world *w);
 
@@ -0,0 +1,276 @@
+#include "worldgen.h"
+
+#include "blocks.h"
+#include "light.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BASE_HEIGHT 64
+#define MAX_HEIGHT  250
+#define SOIL_DEPTH  4
+/* the sections terrain can be in, Y 0 to 15 */
+#define TERRAIN_SECTIONS_LEN 16
+
+enum gen_block {
+	GEN_AIR,
+	GEN_BEDROCK,
+	GEN_STONE,
+	GEN_DIRT,
+	GEN_GRASS,
+	GEN_SAND,
+	GEN_WATER,
+	GEN_BLOCKS_LEN,
+};
+
+static const char *gen_block_names[GEN_BLOCKS_LEN] = {
+	[GEN_AIR] = "minecraft:air",
+	[GEN_BEDROCK] = "minecraft:bedrock",
+	[GEN_STONE] = "minecraft:stone",
+	[GEN_DIRT] = "minecraft:dirt",
+	[GEN_GRASS] = "minecraft:grass_block",
+	[GEN_SAND] = "minecraft:sand",
+	[GEN_WATER] = "minecraft:water",
+};
+
+/* Every spacing is a multiple of 16, so a chunk is always inside a single
+ * lattice cell of every octave */
+static const struct octave {
+	int spacing;
+	float amplitude;
+} octaves[] = {
+	{ 256, 24 }, { 128, 12 }, { 64, 6 }, { 32, 3 }, { 16, 1.5 },
+};
+#define OCTAVES_LEN (int) (sizeof(octaves) / sizeof(octaves[0]))
+
+struct worldgen {
+	uint64_t seed;
+	int ids[GEN_BLOCKS_LEN];
+};
+
+struct worldgen *worldgen_new(int64_t seed, struct hashmap *block_table)
+{
+	struct worldgen *g = malloc(sizeof(struct worldgen));
+	if (g == NULL)
+		return NULL;
+	g->seed = seed;
+	for (int b = 0; b < GEN_BLOCKS_LEN; ++b) {
+		int64_t *id =
+		    hashmap_get(block_table, (char *) gen_block_names[b]);
+		if (id == NULL) {
+			fprintf(stderr, "worldgen_new(): no block \"%s\"\n",
+				gen_block_names[b]);
+			free(g);
+			return NULL;
+		}
+		g->ids[b] = *id;
+	}
+	return g;
+}
+
+void worldgen_free(struct worldgen *g)
+{
+	free(g);
+}
+
+/* splitmix64's finalizer */
+static uint64_t mix(uint64_t h)
+{
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111eb;
+	return h ^ (h >> 31);
+}
+
+/* the noise's value at a lattice point, in [-1, 1) */
+static float lattice(uint64_t seed, int octave, int x, int z)
+{
+	uint64_t h = mix(seed + octave);
+	h = mix(h ^ (uint32_t) x);
+	h = mix(h ^ (uint32_t) z);
+	return (float) (h >> 40) / (1 << 23) - 1;
+}
+
+static int floor_div(int n, int d)
+{
+	return n >= 0 ? n / d : -((-n - 1) / d) - 1;
+}
+
+static float smoothstep(float t)
+{
+	return t * t * (3 - 2 * t);
+}
+
+/* Adds one octave of value noise to a chunk's heights. Only the corners of
+ * the lattice cell are hashed; the rest is interpolation along rows of 16,
+ * which has no branches so the compiler can vectorize it */
+static void add_octave(const struct worldgen *g, int o, int b_x, int b_z,
+		       float heights[16][16])
+{
+	const int spacing = octaves[o].spacing;
+	const float amplitude = octaves[o].amplitude;
+	int l_x = floor_div(b_x, spacing);
+	int l_z = floor_div(b_z, spacing);
+	float c00 = lattice(g->seed, o, l_x, l_z);
+	float c10 = lattice(g->seed, o, l_x + 1, l_z);
+	float c01 = lattice(g->seed, o, l_x, l_z + 1);
+	float c11 = lattice(g->seed, o, l_x + 1, l_z + 1);
+
+	/* where the chunk starts inside the cell */
+	int o_x = b_x - l_x * spacing;
+	int o_z = b_z - l_z * spacing;
+	float wx[16];
+	for (int x = 0; x < 16; ++x)
+		wx[x] = smoothstep((float) (o_x + x) / spacing);
+	for (int z = 0; z < 16; ++z) {
+		float wz = smoothstep((float) (o_z + z) / spacing);
+		for (int x = 0; x < 16; ++x) {
+			float north = c00 + (c10 - c00) * wx[x];
+			float south = c01 + (c11 - c01) * wx[x];
+			heights[z][x] +=
+			    amplitude * (north + (south - north) * wz);
+		}
+	}
+}
+
+/* height is the Y of the column's top solid block */
+static enum gen_block gen_block_at(int height, int y)
+{
+	if (y == 0)
+		return GEN_BEDROCK;
+	else if (y > height)
+		return y <= WORLDGEN_SEA_LEVEL ? GEN_WATER : GEN_AIR;
+	else if (y <= height - SOIL_DEPTH)
+		return GEN_STONE;
+	else if (height <= WORLDGEN_SEA_LEVEL + 1)
+		return GEN_SAND;
+	else
+		return y == height ? GEN_GRASS : GEN_DIRT;
+}
+
+static int popcount(unsigned n)
+{
+	int count = 0;
+	for (; n != 0; n &= n - 1)
+		++count;
+	return count;
+}
+
+static size_t section_arena_len(unsigned used)
+{
+	int palette_len = popcount(used);
+	size_t len = CHUNK_ARENA_ALIGN(palette_len * sizeof(int));
+	if (palette_len > 1)
+		len += BLOCKSTATES_LEN(MIN_BITS_PER_BLOCK) * sizeof(uint64_t);
+	return len;
+}
+
+static void fill_section(const struct worldgen *g, struct chunk *c,
+			 struct section *s, const uint8_t *blocks,
+			 unsigned used)
+{
+	int palette_idx[GEN_BLOCKS_LEN];
+	s->palette_len = popcount(used);
+	s->palette = chunk_alloc(c, s->palette_len * sizeof(int));
+	s->bits_per_block = MIN_BITS_PER_BLOCK;
+	int p = 0;
+	for (int b = 0; b < GEN_BLOCKS_LEN; ++b) {
+		if (used & (1 << b)) {
+			palette_idx[b] = p;
+			s->palette[p++] = g->ids[b];
+		}
+	}
+	if (s->palette_len == 1)
+		return;
+
+	uint16_t idxs[TOTAL_BLOCKSTATES];
+	for (int i = 0; i < TOTAL_BLOCKSTATES; ++i)
+		idxs[i] = palette_idx[blocks[i]];
+	s->blockstates = chunk_alloc(
+	    c, BLOCKSTATES_LEN(MIN_BITS_PER_BLOCK) * sizeof(uint64_t));
+	section_pack(s, idxs);
+}
+
+/* FIXME: sky light only goes straight down, so the sides of cliffs are as
+ *        dark as caves until something relights them */
+static void fill_sky_light(struct chunk *c, const int heights[256])
+{
+	uint8_t light[SECTION_LIGHT_LEN];
+	int levels[256];
+	for (int col = 0; col < 256; ++col)
+		levels[col] = 15;
+	for (int i = CHUNK_SECTIONS_LEN - 1; i > 0; --i) {
+		int base = c->sections[i].y * 16;
+		for (int y = 15; y >= 0; --y) {
+			for (int col = 0; col < 256; ++col) {
+				enum gen_block b = gen_block_at(heights[col],
+								base + y);
+				if (b == GEN_WATER && levels[col] > 0)
+					--levels[col];
+				else if (b != GEN_AIR && b != GEN_WATER)
+					levels[col] = 0;
+				else if (levels[col] < 15 && levels[col] > 0)
+					--levels[col];
+				light_set(light, col % 16, y, col / 16,
+					  levels[col]);
+			}
+		}
+		c->sections[i].sky_light = light_intern(light);
+	}
+}
+
+struct chunk *worldgen_chunk(const struct worldgen *g, int c_x, int c_z)
+{
+	float noise[16][16] = { 0 };
+	for (int o = 0; o < OCTAVES_LEN; ++o)
+		add_octave(g, o, c_x * 16, c_z * 16, noise);
+	int heights[256];
+	for (int col = 0; col < 256; ++col) {
+		int h = BASE_HEIGHT + (int) floorf(noise[col / 16][col % 16]);
+		heights[col] = h < 1 ? 1 : h > MAX_HEIGHT ? MAX_HEIGHT : h;
+	}
+
+	uint8_t(*blocks)[TOTAL_BLOCKSTATES] =
+	    malloc(TERRAIN_SECTIONS_LEN * TOTAL_BLOCKSTATES);
+	if (blocks == NULL)
+		return NULL;
+	unsigned used[TERRAIN_SECTIONS_LEN] = { 0 };
+	size_t arena_len = 0;
+	for (int i = 0; i < TERRAIN_SECTIONS_LEN; ++i) {
+		for (int y = 0; y < 16; ++y) {
+			uint8_t *layer = blocks[i] + y * 256;
+			for (int col = 0; col < 256; ++col) {
+				layer[col] = gen_block_at(heights[col],
+							  i * 16 + y);
+				used[i] |= 1 << layer[col];
+			}
+		}
+		if (used[i] != 1 << GEN_AIR)
+			arena_len += section_arena_len(used[i]);
+	}
+
+	struct chunk *c = chunk_new(arena_len);
+	if (c == NULL) {
+		free(blocks);
+		return NULL;
+	}
+	/* every section gets sky light, even the empty ones above the
+	 * terrain, so clients don't treat them as dark */
+	c->sections_len = CHUNK_SECTIONS_LEN;
+	for (int i = 0; i < TERRAIN_SECTIONS_LEN; ++i) {
+		if (used[i] != 1 << GEN_AIR) {
+			struct section *s =
+			    &c->sections[CHUNK_SECTION_INDEX(i)];
+			fill_section(g, c, s, blocks[i], used[i]);
+		}
+	}
+	free(blocks);
+
+	fill_sky_light(c, heights);
+	/* TODO: biomes, everything's plains for now */
+	memset(c->biomes, 1, BIOMES_LEN);
+	chunk_compute_heightmap(c, block_blocks_motion);
+	return c;
+}
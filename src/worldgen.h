@@ -0,0 +1,26 @@
+/* A simple seed-based terrain generator, for chunks that aren't in the world
+ * yet. Terrain is a heightmap made of a few octaves of value noise, filled
+ * with stone, topped with dirt and grass (or sand near the water), with water
+ * up to sea level. The same seed always makes the same terrain. */
+#ifndef CHOWDER_WORLDGEN_H
+#define CHOWDER_WORLDGEN_H
+
+#include "chunk.h"
+#include "hashmap.h"
+
+#include <stdint.h>
+
+#define WORLDGEN_SEA_LEVEL 62
+
+struct worldgen;
+
+/* returns NULL if the blocks it needs aren't in the block table */
+struct worldgen *worldgen_new(int64_t seed, struct hashmap *block_table);
+void worldgen_free(struct worldgen *);
+
+/* Takes global chunk coordinates. The chunk comes with its heightmap and sky
+ * light, and is ready to be sent. This doesn't touch anything shared besides
+ * the light table, so it can be called from any thread */
+struct chunk *worldgen_chunk(const struct worldgen *, int c_x, int c_z);
+
+#endif // CHOWDER_WORLDGEN_H
@@ -149,7 +149,7 @@ int main(int argc, char **argv)
 			print_section_func print_section =
 			    pretty_print ? pretty_print_section
 					 : raw_print_section;
-			print_section(c->sections[pos->section], pos);
+			print_section(&c->sections[pos->section], pos);
 		} else {
 			print_chunk_func print_chunk =
 			    pretty_print ? pretty_print_chunk : raw_print_chunk;
@@ -295,6 +295,10 @@ void pretty_print_section(const struct section *s, const struct pos *p)
 		printf("    ]\n");
 
 		printf("    bits_per_block = %d\n", s->bits_per_block);
+		if (section_is_uniform(s)) {
+			printf("    uniform\n");
+			return;
+		}
 		printf("    blockstates length: %d\n",
 		       BLOCKSTATES_LEN(s->bits_per_block));
 	}
@@ -311,7 +315,7 @@ void raw_print_section(const struct section *s, const struct pos *p)
 	}
 	printf("%d\n", s->bits_per_block);
 	for (int i = 0; i < BLOCKSTATES_LEN(s->bits_per_block); ++i) {
-		printf("%lu\n", s->blockstates[i]);
+		printf("%lu\n", section_is_uniform(s) ? 0 : s->blockstates[i]);
 	}
 }
 
@@ -320,7 +324,7 @@ void print_sections(const struct chunk *c, struct pos *p,
 {
 	for (int i = 0; i < c->sections_len; ++i) {
 		p->section = i;
-		print_section(c->sections[i], p);
+		print_section(&c->sections[i], p);
 	}
 }
 
@@ -340,12 +344,12 @@ void raw_print_chunk(const struct chunk *c, struct pos *p)
 
 void print_block_at(struct chunk *c, struct world_pos *w)
 {
-	int i = (w->y / 16) + 1;
+	int i = CHUNK_SECTION_INDEX(w->y / 16);
 	if (i < 0 || i >= c->sections_len) {
 		fprintf(stderr, "cv: invalid y coordinate %d\n", w->y);
 		exit(EXIT_FAILURE);
 	}
-	struct section *s = c->sections[i];
+	struct section *s = &c->sections[i];
 	i = read_blockstate_at(s, w->x, w->y, w->z);
 	printf("section coords: (%d,%d,%d)\n", w->x / 16, s->y, w->z / 16);
 	printf("global coords: (%d,%d,%d) = %s\n", w->x, w->y, w->z,
@@ -267,6 +267,7 @@ static char *ftype_to_packet_type(uint32_t ft)
 		case FT_BOOL:
 		case FT_BYTE:
 		case FT_UBYTE:
+		case FT_ANGLE:
 			return "byte";
 		case FT_SHORT:
 		case FT_USHORT:
@@ -0,0 +1,446 @@
+/* pregen generates a square of chunks around a point ahead of time, so the
+ * server doesn't have to generate them while players are walking around.
+ * Chunks that are already in the world are copied over byte for byte, only
+ * the missing ones get generated and encoded.
+ *
+ * Ex. "pregen -r 32 -c 10,-4 ../../levels/default" makes sure every chunk
+ * from -22,-36 to 42,28 exists.
+ *
+ * Every missing chunk is its own job, spread across all cores. Region files
+ * are written to r.x.z.mca.tmp and renamed over the old ones once every chunk
+ * in them is done, so an interrupted run doesn't leave half a region behind.
+ * Regions that aren't missing anything are left alone.
+ */
+#include "anvil.h"
+#include "blocks.h"
+#include "chunk_index.h"
+#include "hashmap.h"
+#include "nbt.h"
+#include "nbt_extra.h"
+#include "pool.h"
+#include "strutil.h"
+#include "worldgen.h"
+#include "zpool.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BLOCKS_JSON_PATH "../../gamedata/blocks.json"
+#define REGION_CHUNKS	 1024
+
+struct region_out {
+	int r_x;
+	int r_z;
+	/* chunks in the square that haven't come back from the pool yet */
+	int pending;
+	uint8_t *chunks[REGION_CHUNKS];
+	size_t lens[REGION_CHUNKS];
+	uint8_t compression[REGION_CHUNKS];
+};
+
+struct pregen {
+	const char *level_path;
+	struct hashmap *block_table;
+	struct worldgen *gen;
+};
+
+struct chunk_job {
+	const struct pregen *p;
+	struct region_out *region;
+	int c_x;
+	int c_z;
+	enum anvil_err err;
+};
+
+void usage();
+int read_seed(const char *level_path, int64_t *seed);
+const char *block_name(int block_id);
+void run_chunk_job(void *data);
+int submit_chunk(struct pool *, const struct pregen *, struct region_out *,
+		 int c_x, int c_z);
+int copy_region(const char *level_path, struct region_out *);
+int write_region(const char *level_path, struct region_out *);
+void free_region_out(struct region_out *);
+double seconds_since(const struct timespec *);
+
+int main(int argc, char **argv)
+{
+	int threads = sysconf(_SC_NPROCESSORS_ONLN);
+	int radius = 16;
+	int center_x = 0;
+	int center_z = 0;
+	bool has_seed = false;
+	int64_t seed = 0;
+
+	int optchar;
+	while ((optchar = getopt(argc, argv, "hj:r:c:s:")) != -1) {
+		switch (optchar) {
+		case 'j':
+			threads = atoi(optarg);
+			break;
+		case 'r':
+			radius = atoi(optarg);
+			break;
+		case 'c':
+			if (sscanf(optarg, "%d,%d", &center_x, &center_z)
+			    != 2) {
+				fprintf(stderr,
+					"pregen: expected x,z, got \"%s\"\n",
+					optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 's':
+			seed = strtoll(optarg, NULL, 10);
+			has_seed = true;
+			break;
+		case 'h':
+			usage();
+			exit(EXIT_SUCCESS);
+		case '?':
+			usage();
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (optind != argc - 1 || threads < 1 || radius < 0) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
+	struct pregen p = { .level_path = argv[optind] };
+	if (!has_seed && read_seed(p.level_path, &seed) < 0)
+		exit(EXIT_FAILURE);
+	char *region_dir;
+	if (asprintf(&region_dir, "%s/region", p.level_path) < 0)
+		exit(EXIT_FAILURE);
+	if (mkdir(region_dir, 0755) < 0 && errno != EEXIST) {
+		fprintf(stderr, "pregen: error creating \"%s\": %s\n",
+			region_dir, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	free(region_dir);
+
+	p.block_table = create_block_table(BLOCKS_JSON_PATH);
+	if (p.block_table == NULL) {
+		fprintf(stderr, "pregen: error creating block table\n");
+		exit(EXIT_FAILURE);
+	}
+	p.gen = worldgen_new(seed, p.block_table);
+	struct pool *pool = p.gen == NULL ? NULL : pool_new(threads);
+	if (pool == NULL) {
+		fprintf(stderr, "pregen: couldn't start generating\n");
+		exit(EXIT_FAILURE);
+	}
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	const int cx1 = center_x - radius;
+	const int cz1 = center_z - radius;
+	const int cx2 = center_x + radius;
+	const int cz2 = center_z + radius;
+	struct chunk_index *index = chunk_index_new(p.level_path, threads);
+	if (index == NULL)
+		exit(EXIT_FAILURE);
+	int saved = 0;
+	for (int c_z = cz1; c_z <= cz2; ++c_z)
+		for (int c_x = cx1; c_x <= cx2; ++c_x)
+			saved += chunk_index_has(index, c_x, c_z);
+	printf("%d of %d chunks are already saved\n", saved,
+	       (cx2 - cx1 + 1) * (cz2 - cz1 + 1));
+	int regions_left = 0;
+	int failed = 0;
+	for (int r_z = cz1 >> 5; r_z <= cz2 >> 5; ++r_z) {
+		for (int r_x = cx1 >> 5; r_x <= cx2 >> 5; ++r_x) {
+			struct region_out *r =
+			    calloc(1, sizeof(struct region_out));
+			if (r == NULL) {
+				perror("pregen: calloc");
+				exit(EXIT_FAILURE);
+			}
+			r->r_x = r_x;
+			r->r_z = r_z;
+			if (copy_region(p.level_path, r) < 0)
+				exit(EXIT_FAILURE);
+			/* submitted a region at a time, so regions finish
+			 * roughly in order and don't all sit in memory */
+			for (int z = 0; z < 32; ++z) {
+				for (int x = 0; x < 32; ++x) {
+					int c_x = r_x * 32 + x;
+					int c_z = r_z * 32 + z;
+					if (c_x < cx1 || c_x > cx2 || c_z < cz1
+					    || c_z > cz2 || r->chunks[x + z * 32])
+						continue;
+					if (submit_chunk(pool, &p, r, c_x, c_z)
+					    < 0) {
+						fprintf(stderr,
+							"pregen: couldn't "
+							"queue chunk %d,%d, "
+							"leaving it out\n",
+							c_x, c_z);
+						++failed;
+					}
+				}
+			}
+			/* nothing to add, so the file can stay as it is */
+			if (r->pending == 0)
+				free_region_out(r);
+			else
+				++regions_left;
+		}
+	}
+
+	int chunks = 0;
+	while (regions_left > 0) {
+		struct chunk_job *job = pool_take_done(pool);
+		if (job == NULL) {
+			nanosleep(&(struct timespec){ .tv_nsec = 1000000 },
+				  NULL);
+			continue;
+		}
+		struct region_out *r = job->region;
+		if (job->err != ANVIL_OK) {
+			fprintf(stderr,
+				"pregen: chunk %d,%d failed, err=%d, leaving it "
+				"out\n",
+				job->c_x, job->c_z, job->err);
+			++failed;
+		} else {
+			++chunks;
+		}
+		free(job);
+		if (--r->pending > 0)
+			continue;
+
+		if (write_region(p.level_path, r) < 0)
+			exit(EXIT_FAILURE);
+		double elapsed = seconds_since(&start);
+		printf("r.%d.%d.mca done, %d chunks in %.1fs (%.0f chunks/s)\n",
+		       r->r_x, r->r_z, chunks, elapsed, chunks / elapsed);
+		free_region_out(r);
+		--regions_left;
+	}
+
+	double elapsed = seconds_since(&start);
+	printf("%d chunks generated in %.2fs using %d threads, %.0f chunks/s\n",
+	       chunks, elapsed, threads, chunks / elapsed);
+	pool_free(pool, free);
+	chunk_index_free(index);
+	worldgen_free(p.gen);
+	hashmap_free(p.block_table, true, free);
+	free_block_names();
+	zpool_free();
+	exit(failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+void usage()
+{
+	printf("usage:\n"
+	       "  pregen [options] level_path  Generate every missing chunk "
+	       "in a square\n"
+	       "\noptions:\n"
+	       "  -r radius: how many chunks out from the center to go, "
+	       "default 16\n"
+	       "  -c x,z: the chunk at the center of the square, default "
+	       "0,0\n"
+	       "  -j threads: how many threads to use, default is one per "
+	       "core\n"
+	       "  -s seed: the seed to generate with, instead of the one in "
+	       "level.dat\n"
+	       "  -h: print this info and exit\n");
+}
+
+int read_seed(const char *level_path, int64_t *seed)
+{
+	char *level_data_path;
+	if (asprintf(&level_data_path, "%s/level.dat", level_path) < 0)
+		return -1;
+	FILE *f = fopen(level_data_path, "r");
+	if (f == NULL) {
+		fprintf(stderr, "pregen: error opening \"%s\": %s\n",
+			level_data_path, strerror(errno));
+		free(level_data_path);
+		return -1;
+	}
+	free(level_data_path);
+	struct nbt *level_data;
+	int err = nbt_unpack_file(fileno(f), &level_data);
+	fclose(f);
+	if (err != 0)
+		return -1;
+	struct nbt *data = nbt_get(level_data, TAG_Compound, "Data");
+	bool found = data != NULL
+		     && nbt_get_value(data, TAG_Long, "RandomSeed", seed);
+	nbt_free(level_data);
+	if (!found) {
+		fprintf(stderr, "pregen: level.dat doesn't have a seed\n");
+		return -1;
+	}
+	return 0;
+}
+
+const char *block_name(int block_id)
+{
+	if (block_id < 0 || (size_t) block_id >= block_names_len)
+		return NULL;
+	return block_names[block_id];
+}
+
+/* reads a chunk's compressed data and compression type straight out of a
+ * region file, *data is NULL if the chunk isn't there */
+static enum anvil_err read_raw_chunk(FILE *f, int i, uint8_t **data,
+				     size_t *len, uint8_t *compression)
+{
+	*data = NULL;
+	uint8_t header[5];
+	if (fseek(f, 4 * i, SEEK_SET) < 0 || fread(header, 1, 4, f) != 4)
+		return ANVIL_READ_ERROR;
+	long offset =
+	    ((long) header[0] << 16 | header[1] << 8 | header[2]) * 4096;
+	if (offset == 0)
+		return ANVIL_OK;
+	if (fseek(f, offset, SEEK_SET) < 0 || fread(header, 1, 5, f) != 5)
+		return ANVIL_READ_ERROR;
+	size_t total = (size_t) header[0] << 24 | header[1] << 16
+		       | header[2] << 8 | header[3];
+	/* the length counts the compression byte, and can't be more than
+	 * the 255 sectors a chunk gets */
+	if (total < 2 || total > 255 * 4096)
+		return ANVIL_READ_ERROR;
+	*len = total - 1;
+	*compression = header[4];
+	*data = malloc(*len);
+	if (*data == NULL)
+		return ANVIL_NO_MEMORY;
+	if (fread(*data, 1, *len, f) != *len) {
+		free(*data);
+		*data = NULL;
+		return ANVIL_READ_ERROR;
+	}
+	return ANVIL_OK;
+}
+
+void run_chunk_job(void *data)
+{
+	struct chunk_job *job = data;
+	int i = (job->c_x & 31) + (job->c_z & 31) * 32;
+	struct chunk *c = worldgen_chunk(job->p->gen, job->c_x, job->c_z);
+	if (c == NULL) {
+		job->err = ANVIL_NO_MEMORY;
+		return;
+	}
+	job->err = anvil_encode_chunk(c, job->c_x, job->c_z, block_name,
+				      &job->region->chunks[i],
+				      &job->region->lens[i]);
+	job->region->compression[i] = ANVIL_COMPRESSION_ZLIB;
+	free_chunk(c);
+}
+
+/* queues a job to generate the chunk, returns -1 if it couldn't be */
+int submit_chunk(struct pool *pool, const struct pregen *p,
+		 struct region_out *r, int c_x, int c_z)
+{
+	struct chunk_job *job = calloc(1, sizeof(struct chunk_job));
+	if (job == NULL)
+		return -1;
+	*job = (struct chunk_job){
+	    .p = p,
+	    .region = r,
+	    .c_x = c_x,
+	    .c_z = c_z,
+	};
+	if (pool_submit(pool, run_chunk_job, job) < 0) {
+		free(job);
+		return -1;
+	}
+	/* only counted once it's sure to come back, or the region would
+	 * wait on it forever */
+	++r->pending;
+	return 0;
+}
+
+/* copies over every chunk that's already saved in the region untouched,
+ * since the region file gets replaced. Fails if any of them can't be read,
+ * rather than losing them. */
+int copy_region(const char *level_path, struct region_out *r)
+{
+	struct region *region;
+	if (region_open(level_path, r->r_x, r->r_z, &region) != ANVIL_OK) {
+		fprintf(stderr, "pregen: error opening r.%d.%d.mca: %s\n",
+			r->r_x, r->r_z, strerror(errno));
+		return -1;
+	}
+	for (int i = 0; region->file != NULL && i < REGION_CHUNKS; ++i) {
+		enum anvil_err err =
+		    read_raw_chunk(region->file, i, &r->chunks[i],
+				   &r->lens[i], &r->compression[i]);
+		if (err != ANVIL_OK) {
+			fprintf(stderr,
+				"pregen: error reading chunk %d,%d from "
+				"r.%d.%d.mca, err=%d\n",
+				r->r_x * 32 + i % 32, r->r_z * 32 + i / 32,
+				r->r_x, r->r_z, err);
+			free_region(region);
+			return -1;
+		}
+	}
+	free_region(region);
+	return 0;
+}
+
+int write_region(const char *level_path, struct region_out *r)
+{
+	char *path;
+	char *tmp_path;
+	if (asprintf(&path, "%s/region/r.%d.%d.mca", level_path, r->r_x,
+		     r->r_z)
+	    < 0)
+		return -1;
+	if (asprintf(&tmp_path, "%s.tmp", path) < 0) {
+		free(path);
+		return -1;
+	}
+
+	int err = -1;
+	FILE *f = fopen(tmp_path, "w");
+	enum anvil_err write_err = ANVIL_ERRNO;
+	if (f != NULL) {
+		write_err = anvil_write_region(f, r->chunks, r->lens,
+					       r->compression);
+		if (fclose(f) != 0)
+			write_err = ANVIL_ERRNO;
+	}
+	if (write_err != ANVIL_OK) {
+		fprintf(stderr, "pregen: error writing \"%s\": %s\n", tmp_path,
+			write_err == ANVIL_ERRNO ? strerror(errno)
+						 : "chunk too big");
+	} else if (rename(tmp_path, path) < 0) {
+		fprintf(stderr, "pregen: error renaming \"%s\": %s\n",
+			tmp_path, strerror(errno));
+	} else {
+		err = 0;
+	}
+	free(path);
+	free(tmp_path);
+	return err;
+}
+
+void free_region_out(struct region_out *r)
+{
+	for (int i = 0; i < REGION_CHUNKS; ++i)
+		free(r->chunks[i]);
+	free(r);
+}
+
+double seconds_since(const struct timespec *start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec)
+	       + (now.tv_nsec - start->tv_nsec) / 1e9;
+}